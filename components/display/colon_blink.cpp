@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "colon_blink.hpp"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Time between colon changes in us (microseconds)
+#define HALF_SECOND_US 500000
+
+// Above the clock and display tasks so the colon is written as close
+// to the edge as we can
+#define TASK_PRIORITY 11
+#define TASK_STACK_SIZE 2048
+
+void ColonBlink::Arm() {
+    int64_t now = now_us_();
+    int64_t next = now / HALF_SECOND_US + 1;
+
+    // esp_timer counts in RTOS ticks so can fire up to a tick or two
+    // early. The edge just handled is then still ahead of us, so skip
+    // to the one after rather than writing it twice.
+    if (next == edge_) {
+        next++;
+    }
+    int64_t delay = next * HALF_SECOND_US - now;
+
+    if (loop_ != NULL) {
+        // The loop counts in ms. Round up so we don't wake early.
+        loop_->Schedule(&loop_timer_, (delay + 999) / 1000);
+    }
+    else {
+        esp_timer_start_once(timer_, delay);
+    }
+}
+
+void ColonBlink::Blink(int64_t edge) {
+    bool on = (edge % 2) == 0;
+
+    display_->SetColon(on);
+
+    // Get the next second ready while there is half a second to spare
+    if (!on && render_ != NULL) {
+        char frame[TM1637::kMaxDigits];
+        render_((edge + 1) * HALF_SECOND_US, frame, render_arg_);
+        display_->Stage(frame);
+    }
+
+    int64_t error = now_us_() - edge * HALF_SECOND_US;
+    int64_t size = (error < 0) ? -error : error;
+    portENTER_CRITICAL();
+    last_error_us_ = error;
+    if (size > max_error_us_) {
+        max_error_us_ = size;
+    }
+    total_error_us_ += size;
+    count_++;
+    portEXIT_CRITICAL();
+}
+
+void ColonBlink::OnTimer(void* arg) {
+    ColonBlink* b = (ColonBlink*)arg;
+
+    // Work out which edge this is for. The timer can fire a little
+    // either side of the edge so round to the nearest one.
+    int64_t now = b->now_us_();
+    portENTER_CRITICAL();
+    b->edge_ = (now + HALF_SECOND_US / 2) / HALF_SECOND_US;
+    portEXIT_CRITICAL();
+
+    b->Arm();
+
+    // Writing to the display waits for the bus, which would hold up
+    // every other esp_timer, so leave it to our task
+    xTaskNotifyGive(b->task_);
+}
+
+void ColonBlink::OnLoopTimer(void* arg) {
+    ColonBlink* b = (ColonBlink*)arg;
+
+    // Nothing else runs on the loop while we write, so there is no
+    // task to hand over to
+    int64_t now = b->now_us_();
+    b->edge_ = (now + HALF_SECOND_US / 2) / HALF_SECOND_US;
+    b->Arm();
+    b->Blink(b->edge_);
+}
+
+void ColonBlink::Run(void* arg) {
+    ColonBlink* b = (ColonBlink*)arg;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // If we fell behind only the latest edge matters
+        portENTER_CRITICAL();
+        int64_t edge = b->edge_;
+        portEXIT_CRITICAL();
+        b->Blink(edge);
+    }
+}
+
+ColonBlink::ColonBlink(TM1637* display, int64_t (*now_us)())
+    : loop_timer_(OnLoopTimer, this) {
+    display_ = display;
+    now_us_ = now_us;
+}
+
+void ColonBlink::SetRender(
+    void (*render)(int64_t us, char* frame, void* arg),
+    void* arg
+) {
+    render_ = render;
+    render_arg_ = arg;
+}
+
+void ColonBlink::Start() {
+    ESP_LOGI(TAG_, "Starting colon blink");
+
+    esp_timer_create_args_t args = {};
+    args.callback = OnTimer;
+    args.arg = this;
+    args.name = "colon_blink";
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer_));
+
+    xTaskCreate(
+        Run,
+        "colon_blink",
+        TASK_STACK_SIZE,
+        this,
+        TASK_PRIORITY,
+        &task_
+    );
+    Arm();
+}
+
+void ColonBlink::Start(EventLoop* loop) {
+    ESP_LOGI(TAG_, "Starting colon blink on event loop");
+    loop_ = loop;
+    Arm();
+}
+
+int64_t ColonBlink::LastErrorUs() {
+    portENTER_CRITICAL();
+    int64_t error = last_error_us_;
+    portEXIT_CRITICAL();
+    return error;
+}
+
+int64_t ColonBlink::MaxErrorUs() {
+    portENTER_CRITICAL();
+    int64_t error = max_error_us_;
+    portEXIT_CRITICAL();
+    return error;
+}
+
+int64_t ColonBlink::MeanErrorUs() {
+    portENTER_CRITICAL();
+    int64_t mean = (count_ == 0) ? 0 : total_error_us_ / count_;
+    portEXIT_CRITICAL();
+    return mean;
+}
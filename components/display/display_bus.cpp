@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "display_bus.hpp"
+
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "driver/hw_timer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Delay used for hardware timer in us (microseconds)
+// Must be > 50
+#define CLK_DELAY 51
+
+#define OP_TYPE(op) ((op) & 0xF00)
+#define OP_DATA(op) ((op) & 0xFF)
+
+bool DisplayBus::Step(Channel* c) {
+    Transfer* t = &c->queue[c->head];
+    uint16_t op = t->ops[c->op];
+    bool op_done = false;
+
+    switch (OP_TYPE(op)) {
+    case DISPLAY_BUS_OP_START:
+        if (c->step == 0) {
+            // Data falls while clock is high
+            gpio_set_level(c->dio, 0);
+        }
+        else {
+            // Note, there is no need to set clock to low here as this
+            // is done first thing when sending a byte.
+            op_done = true;
+        }
+        break;
+    case DISPLAY_BUS_OP_BYTE:
+        if (c->step == 0) {
+            c->data = OP_DATA(op);
+        }
+        switch (c->step % 3) {
+        case 0: // Clock falling
+            gpio_set_level(c->clk, 0);
+            break;
+        case 1: // Clock low, set data bit
+            gpio_set_level(c->dio, c->data & 0x01);
+            c->data = c->data >> 1;
+            break;
+        case 2: // Clock rising
+            gpio_set_level(c->clk, 1);
+            // Eight data bits followed by the ack
+            op_done = c->step > 24;
+            break;
+        }
+        break;
+    case DISPLAY_BUS_OP_STOP:
+        switch (c->step) {
+        case 0: // Clock falling
+            gpio_set_level(c->clk, 0);
+            break;
+        case 1: // Clock low, data is still low from ack
+            break;
+        case 2: // Clock goes high
+            gpio_set_level(c->clk, 1);
+            break;
+        case 3: // Clock is now high, data can go high
+            gpio_set_level(c->dio, 1);
+            op_done = true;
+            break;
+        }
+        break;
+    default:
+        // Unknown operation, skip it
+        op_done = true;
+        break;
+    }
+
+    c->step++;
+    if (op_done) {
+        c->step = 0;
+        c->op++;
+    }
+    return c->op >= t->len;
+}
+
+void DisplayBus::TimerISR(void* arg) {
+    DisplayBus* bus = (DisplayBus*)arg;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    bool busy = false;
+
+    for (int i = 0; i < bus->num_channels_; i++) {
+        Channel* c = &bus->channels_[i];
+        if (c->count == 0) {
+            continue;
+        }
+
+        if (Step(c)) {
+            xSemaphoreGiveFromISR(
+                c->queue[c->head].done,
+                &higher_priority_task_woken
+            );
+            xSemaphoreGiveFromISR(c->free, &higher_priority_task_woken);
+            c->head = (c->head + 1) % kQueueDepth;
+            c->count = c->count - 1;
+            c->op = 0;
+            c->step = 0;
+        }
+
+        if (c->count != 0) {
+            busy = true;
+        }
+    }
+
+    if (!busy) {
+        hw_timer_disarm();
+        bus->running_ = false;
+    }
+
+    portEND_SWITCHING_ISR(higher_priority_task_woken);
+}
+
+DisplayBus::DisplayBus() {
+    memset(channels_, 0, sizeof(channels_));
+    hw_timer_init(TimerISR, this);
+}
+
+DisplayBus* DisplayBus::Shared() {
+    static DisplayBus bus;
+    return &bus;
+}
+
+int DisplayBus::Attach(gpio_num_t dio, gpio_num_t clk) {
+    if (num_channels_ >= kMaxChannels) {
+        ESP_LOGE(TAG_, "No free channels for display on %d, %d", dio, clk);
+        return -1;
+    }
+
+    ESP_LOGI(
+        TAG_,
+        "Attaching display on channel %d using pins:\n\tDIO: %d\n\tCLK: %d",
+        num_channels_,
+        dio,
+        clk
+    );
+
+    gpio_config_t config;
+    config.intr_type = GPIO_INTR_DISABLE; // Disable interupts
+    config.mode = GPIO_MODE_OUTPUT;
+    config.pin_bit_mask = ((1ULL << dio) | (1ULL << clk));
+    config.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    config.pull_up_en = GPIO_PULLUP_DISABLE;
+    gpio_config(&config);
+
+    // Both pins are expected high
+    gpio_set_level(dio, 1);
+    gpio_set_level(clk, 1);
+
+    Channel* c = &channels_[num_channels_];
+    c->dio = dio;
+    c->clk = clk;
+    c->free = xSemaphoreCreateCounting(kQueueDepth, kQueueDepth);
+    for (int i = 0; i < kQueueDepth; i++) {
+        c->queue[i].done = xSemaphoreCreateBinary();
+    }
+
+    // Only make the channel visible to the ISR once it is set up
+    portENTER_CRITICAL();
+    int channel = num_channels_++;
+    portEXIT_CRITICAL();
+    return channel;
+}
+
+int DisplayBus::Submit(
+    int channel,
+    const uint16_t* ops,
+    int len,
+    TickType_t timeout
+) {
+    if (channel < 0 || channel >= num_channels_
+        || len <= 0 || len > DISPLAY_BUS_MAX_OPS) {
+        return -1;
+    }
+
+    Channel* c = &channels_[channel];
+    if (xSemaphoreTake(c->free, timeout) != pdTRUE) {
+        ESP_LOGE(TAG_, "Queue for channel %d is full", channel);
+        return -1;
+    }
+
+    // The ISR moves head and count together so read them together
+    portENTER_CRITICAL();
+    int slot = (c->head + c->count) % kQueueDepth;
+    portEXIT_CRITICAL();
+
+    // The ISR doesn't look at a slot until it has been counted, so it
+    // can be filled in without holding anything.
+    Transfer* t = &c->queue[slot];
+    memcpy(t->ops, ops, len * sizeof(ops[0]));
+    t->len = len;
+
+    // Clear a completion left over from a wait that timed out
+    xSemaphoreTake(t->done, 0);
+
+    portENTER_CRITICAL();
+    c->count = c->count + 1;
+    if (!running_) {
+        running_ = true;
+        hw_timer_alarm_us(CLK_DELAY, true);
+    }
+    portEXIT_CRITICAL();
+
+    return slot;
+}
+
+bool DisplayBus::Wait(int channel, int slot, TickType_t timeout) {
+    if (channel < 0 || channel >= num_channels_ || slot < 0) {
+        return false;
+    }
+    return xSemaphoreTake(
+        channels_[channel].queue[slot].done,
+        timeout
+    ) == pdTRUE;
+}
@@ -0,0 +1,119 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef DISPLAY_COLON_BLINK_H_
+#define DISPLAY_COLON_BLINK_H_
+
+#include <stdint.h>
+
+#include "tm1637.hpp"
+
+#include "esp_timer.h"
+#include "scheduler/event_loop.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Blinks the colon of a display in phase with the wall clock. The colon
+// turns on at .000 and off at .500 of every second, so any number of
+// synchronised clocks blink together.
+//
+// A one shot timer is re-armed for the next half second edge each time
+// it fires, using the current wall clock. This means the blink follows
+// the clock when SNTP steps it rather than drifting with the timer.
+//
+// The hardware timer is busy clocking data out to the display, so this
+// uses an esp_timer. esp_timers all run from one task, so the callback
+// only works out which edge is due and wakes our own task to write to
+// the display. The time taken to do so is included in the reported
+// phase error.
+//
+// If a render function is set, the frame for the next second is
+// rendered on each .500 edge and staged on the display. It is then
+// written along with the colon on the .000 edge, so the digits change
+// exactly on the second.
+//
+// When everything else runs on an EventLoop the blink can run there
+// too, from a one shot loop timer, instead of needing a task of its
+// own.
+class ColonBlink
+{
+private:
+    TM1637* display_;
+
+    // Source of wall clock time in microseconds since the epoch
+    int64_t (*now_us_)();
+
+    esp_timer_handle_t timer_ = NULL;
+
+    // Task that writes to the display
+    TaskHandle_t task_ = NULL;
+
+    // Loop and timer used instead of the esp_timer and task when
+    // started on an event loop
+    EventLoop* loop_ = NULL;
+    Timer loop_timer_;
+
+    // Number of the last half second edge since the epoch the timer
+    // fired for
+    int64_t edge_ = -1;
+
+    // Fills frame with the digits to show at the given wall clock time
+    void (*render_)(int64_t us, char* frame, void* arg) = NULL;
+    void* render_arg_ = NULL;
+
+    // Phase error statistics. The error is the time between the half
+    // second edge and the colon having been written to the display.
+    // Only touched in a critical section, as they are read from other
+    // tasks.
+    int64_t last_error_us_ = 0;
+    int64_t max_error_us_ = 0;
+    int64_t total_error_us_ = 0;
+    uint32_t count_ = 0;
+
+    // Tag to use for logging
+    const char TAG_[20] = "DISPLAY::COLONBLINK";
+
+    // Arm the timer for the next half second edge
+    void Arm();
+
+    // Set the colon for an edge and stage the next frame
+    void Blink(int64_t edge);
+
+    // Callback for timer
+    static void OnTimer(void* arg);
+
+    // Callback for the loop timer
+    static void OnLoopTimer(void* arg);
+
+    // Task waiting for the timer
+    static void Run(void* arg);
+
+public:
+    // Constructor. Set the display to blink and the wall clock source
+    ColonBlink(TM1637* display, int64_t (*now_us)());
+
+    // Set a function to render the frame shown from a given wall clock
+    // time in microseconds since the epoch. Must be set before Start().
+    void SetRender(
+        void (*render)(int64_t us, char* frame, void* arg),
+        void* arg
+    );
+
+    // Start the task and start blinking
+    void Start();
+
+    // Start blinking from a timer on loop rather than a task. Must be
+    // called before the loop is started or from a callback on it.
+    void Start(EventLoop* loop);
+
+    // Phase error of the last blink in microseconds
+    int64_t LastErrorUs();
+
+    // Largest phase error seen in microseconds
+    int64_t MaxErrorUs();
+
+    // Mean phase error in microseconds
+    int64_t MeanErrorUs();
+};
+
+#endif  // DISPLAY_COLON_BLINK_H_
@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef DISPLAY_DISPLAY_BUS_H_
+#define DISPLAY_DISPLAY_BUS_H_
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Operations that make up a transfer. The low byte holds the data for
+// DISPLAY_BUS_OP_BYTE.
+#define DISPLAY_BUS_OP_START 0x100
+#define DISPLAY_BUS_OP_BYTE 0x200
+#define DISPLAY_BUS_OP_STOP 0x300
+
+// Longest transfer in operations
+#define DISPLAY_BUS_MAX_OPS 24
+
+// Shares the ESP8266's single hardware timer between several bit banged
+// two wire displays, each on their own pair of pins.
+//
+// Each display attached to the bus gets a small queue of transfers. A
+// transfer is a list of start, byte and stop operations. On every timer
+// tick the ISR moves each display with a queued transfer on by one
+// step, so several displays are clocked out side by side in about the
+// time it takes to update one. The timer only runs while there is work
+// queued.
+class DisplayBus
+{
+private:
+    static const int kMaxChannels = 4;
+    static const int kQueueDepth = 2;
+
+    struct Transfer {
+        uint16_t ops[DISPLAY_BUS_MAX_OPS];
+        int len;
+
+        // Given by the ISR when the transfer has been sent
+        SemaphoreHandle_t done;
+    };
+
+    struct Channel {
+        gpio_num_t dio;
+        gpio_num_t clk;
+
+        Transfer queue[kQueueDepth];
+
+        // Counts free slots in the queue
+        SemaphoreHandle_t free;
+
+        // Slot being sent and number of slots queued
+        volatile int head;
+        volatile int count;
+
+        // Position within the transfer being sent
+        int op;
+        int step;
+        int data;
+    };
+
+    Channel channels_[kMaxChannels];
+    int num_channels_ = 0;
+
+    // Is the timer running
+    volatile bool running_ = false;
+
+    // Tag to use for logging
+    const char TAG_[13] = "DISPLAY::BUS";
+
+    // Move a channel on by one step. Returns true when the transfer at
+    // the head of its queue has finished.
+    static bool Step(Channel* c);
+
+    // Callback for timer
+    static void TimerISR(void* arg);
+
+public:
+    // Constructor. Takes ownership of the hardware timer
+    DisplayBus();
+
+    // Get the bus shared by all displays
+    static DisplayBus* Shared();
+
+    // Add a display on the given pins. Returns the channel to use for
+    // transfers or -1 if there are no channels left.
+    int Attach(gpio_num_t dio, gpio_num_t clk);
+
+    // Queue a transfer on a channel. Blocks for up to timeout ticks if
+    // the channel's queue is full. Only one task may submit to a given
+    // channel at a time. Returns the slot to pass to Wait()
+    // or -1 on failure.
+    int Submit(int channel, const uint16_t* ops, int len, TickType_t timeout);
+
+    // Wait up to timeout ticks for a submitted transfer to be sent.
+    // Returns true once it has been.
+    bool Wait(int channel, int slot, TickType_t timeout);
+};
+
+#endif  // DISPLAY_DISPLAY_BUS_H_
@@ -4,6 +4,7 @@
 #ifndef DISPLAY_TM1367_H_
 #define DISPLAY_TM1367_H_
 
+#include "display_bus.hpp"
 #include "segment.hpp"
 
 #include "driver/gpio.h"
@@ -14,6 +15,10 @@
 
 class TM1637: Segment
 {
+public:
+    // Most digits the TM1637 can drive
+    static const int kMaxDigits = 6;
+
 private:
     // Data in out pin
     gpio_num_t dio_;
@@ -24,14 +29,48 @@ private:
     // Tag to use for logging
     const char TAG_[16] = "DISPLAY::TM1637";
 
-    // Used to work out where we are in the bit sending sequence
-    int counter_ = 0;
+    // Bus the display is attached to and our channel on it
+    DisplayBus* bus_;
+    int channel_;
+
+    // Serialises access to the display between tasks
+    SemaphoreHandle_t bus_mutex_;
+
+    // Brightness level sent with the display control command. 0 - 7
+    int brightness_ = 7;
+
+    // Is the colon between hours and minutes lit
+    bool colon_ = true;
+
+    // Last characters written to the display
+    char frame_[kMaxDigits] = {0};
 
-    // Current data that is being sent to the IC
-    int data_;
+    // Has anything been written yet. Until then every digit is sent
+    // as we don't know what the display is showing.
+    bool shown_ = false;
 
-    // Used to indicate when ISR has finished writing to IC
-    SemaphoreHandle_t write_semaphore_;
+    // When every digit was last written
+    int64_t last_full_us_ = 0;
+
+    // Frame waiting to be written with the next colon change
+    char staged_[kMaxDigits] = {0};
+    bool has_staged_ = false;
+
+    // Time spent on the bus in each second of uptime. busy_us_ is the
+    // total so far for busy_second_. The max and mean are over
+    // completed seconds. pending_ transfers have been queued since
+    // busy_start_.
+    int64_t busy_second_ = -1;
+    int pending_ = 0;
+    int64_t busy_start_ = 0;
+    int64_t busy_us_ = 0;
+    int64_t busy_max_us_ = 0;
+    int64_t busy_total_us_ = 0;
+    uint32_t busy_seconds_ = 0;
+
+    // Called each time a frame has been written to the display
+    void (*on_commit_)(const char* frame, int len, void* arg) = NULL;
+    void* on_commit_arg_ = NULL;
 
     // Supported values for display
     //
@@ -66,31 +105,78 @@ private:
     // Initialize the display
     void Init();
 
-    // Send a single byte to the IC
-    void SendByte(int b);
+    // Get the segments to send for the character at position pos of
+    // the current frame
+    int Encode(int pos);
 
-    // Send a single byte to the IC
-    static void SendByteISR(void* arg);
+    // Update the current frame from msg and fill ops with a transfer
+    // that writes only the digits that changed, one address command
+    // per run of them. If colon_changed the digit holding the colon is
+    // written too. Every digit is written after a failed transfer and
+    // once a minute. Must be called with bus_mutex_ held. Returns the
+    // number of ops.
+    int Build(uint16_t* ops, const char* msg, bool colon_changed);
 
-    // Send start signal to TM1637
-    void Start();
+    // Queue a transfer on the bus. Must be called with bus_mutex_ held.
+    // Returns the slot to pass to Finish()
+    int Submit(const uint16_t* ops, int len);
 
-    // Callback for timer.
-    // This is the method that actually writes the start bits to the device
-    static void StartISR(void* arg);
+    // Wait for a transfer to be sent. Returns true if it was. Must be
+    // called without bus_mutex_ held.
+    bool Finish(int slot);
 
-    // Send stop signal to TM1637
-    void Stop();
-
-    // Callback for stop timer
-    static void StopISR(void* arg);
+    // Count a queued transfer as finished, for the bus busy totals
+    void Done();
 
 public:
-    // Constructor. Set pins for data I/O and clock
-    TM1637(int dio, int clk);
-
+    // Constructor. Set pins for data I/O and clock, the number of
+    // digits on the display and the bus that drives them. Displays on
+    // the same bus are updated side by side.
+    TM1637(
+        int dio,
+        int clk,
+        int len = 4,
+        DisplayBus* bus = DisplayBus::Shared()
+    );
+
+    // Write a frame of one value per digit. Only the digits that have
+    // changed since the last write are sent.
     void Write(char* msg);
 
+    // Hold a frame to be written along with the next call to
+    // SetColon(). Lets a frame be rendered ahead of time and then
+    // committed on the edge of a second.
+    void Stage(const char* msg);
+
+    // Set the brightness of the display. Takes a level from 0 (dimmest)
+    // to 7 (brightest) which is applied on the next write.
+    void SetBrightness(int level);
+
+    // Get the current brightness level
+    int Brightness();
+
+    // Set a function to be called each time a frame has been written
+    // to the display. It is passed the characters written. Called from
+    // the writing task with the display locked, so it must be quick.
+    void SetOnCommit(
+        void (*callback)(const char* frame, int len, void* arg),
+        void* arg
+    );
+
+    // Turn the colon between hours and minutes on or off. Only the
+    // digit holding the colon is rewritten, along with any digits of a
+    // staged frame that changed, so this is quick enough to call on a
+    // timer.
+    void SetColon(bool on);
+
+    // Largest total time in microseconds the display kept the bus
+    // busy for in any one second
+    int64_t BusMaxUs();
+
+    // Mean time in microseconds per second the display kept the bus
+    // busy for
+    int64_t BusMeanUs();
+
     // For use in FreeRTOS tasks. Wait for a message to be sent via
     // the queue.
     void WaitForMsg(QueueHandle_t* queue);
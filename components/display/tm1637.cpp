@@ -3,232 +3,290 @@
 
 #include "tm1637.hpp"
 
+#include <string.h>
+
+#include "display_bus.hpp"
+
 #include "driver/gpio.h"
-#include "driver/hw_timer.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 
-// Delay used for hardware timer in us (microseconds)
-// Must be > 50
-#define CLK_DELAY 51
-
 // Maximum time to wait before failing send
 #define MAX_SEND_TIMEOUT 200
 
-void TM1637::Init() {
-    ESP_LOGI(TAG_, "Initialising TM1637");
-    ESP_LOGI(
-        TAG_,
-        "Using following pins:\n\tDIO: %d\n\tCLK: %d",
-        dio_,
-        clk_
-    );
+// How often every digit is rewritten, in case an incremental write was
+// garbled on the wire
+#define FULL_REFRESH_US (60LL * 1000000)
 
-    gpio_config_t config;
-    config.intr_type = GPIO_INTR_DISABLE; // Disable interupts
-    config.mode = GPIO_MODE_OUTPUT;
-    config.pin_bit_mask = ((1ULL << dio_) | (1ULL << clk_));
-    config.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    config.pull_up_en = GPIO_PULLUP_DISABLE;
-    gpio_config(&config);
+#define START DISPLAY_BUS_OP_START
+#define BYTE(b) (DISPLAY_BUS_OP_BYTE | ((b) & 0xFF))
+#define STOP DISPLAY_BUS_OP_STOP
 
-    // Both pins are expected high
-    gpio_set_level(dio_, 1);
-    gpio_set_level(clk_, 1);
+void TM1637::Init() {
+    ESP_LOGI(TAG_, "Initialising TM1637");
+    channel_ = bus_->Attach(dio_, clk_);
 }
 
-void TM1637::SendByte(int b) {
-    // Init our variables
-    data_ = b;
-    counter_ = 0;
-
-    // Task notification setup
-    const TickType_t max_block_time = pdMS_TO_TICKS(MAX_SEND_TIMEOUT);
-
-    // Set of the timer
-    hw_timer_init(SendByteISR, this);
-    hw_timer_alarm_us(CLK_DELAY, true);
+int TM1637::Encode(int pos) {
+    int segments = digits_[(int)frame_[pos]];
+    if (pos == 1 && colon_) {
+        // Include colon between hours and minutes
+        segments |= digits_[16];
+    }
+    return segments;
+}
 
-    // Wait until finished writing to display
-    int result = xSemaphoreTake(write_semaphore_, max_block_time);
+int TM1637::Build(uint16_t* ops, const char* msg, bool colon_changed) {
+    int len = 0;
 
-    if (result != pdTRUE) {
-        ESP_LOGE(
-            TAG_,
-            "Failed to write byte to display. Function timed out after 200ms"
-        );
+    int64_t now = esp_timer_get_time();
+    if (now - last_full_us_ >= FULL_REFRESH_US) {
+        shown_ = false;
+    }
+    if (!shown_) {
+        last_full_us_ = now;
     }
 
-    hw_timer_deinit();
-}
-
-void TM1637::SendByteISR(void* arg) {
-    TM1637* t = (TM1637*)arg;
-    switch (t->counter_ % 3) {
-    case 0: // Clock falling
-        gpio_set_level(t->clk_, 0);
-        break;
-    case 1: // Clock low, set data bit
-        gpio_set_level(t->dio_, t->data_ & 0x01);
-        t->data_ = t->data_ >> 1;
-        break;
-    case 2: // Clock rising
-        gpio_set_level(t->clk_, 1);
-        if (t->counter_ > 24) {
-            // We have sent the last bit
-            BaseType_t higher_priority_task_woken = pdFALSE;
-            xSemaphoreGiveFromISR(
-                t->write_semaphore_,
-                &higher_priority_task_woken
-            );
-            portEND_SWITCHING_ISR(higher_priority_task_woken);
+    // Find the digits that need to be sent
+    bool changed[kMaxDigits];
+    for (int i = 0; i < max_chars_; i++) {
+        changed[i] = !shown_ || frame_[i] != msg[i];
+        /* TODO: Should probably check it is a valid char */
+        frame_[i] = msg[i];
+    }
+    if (colon_changed && max_chars_ > 1) {
+        changed[1] = true;
+    }
+    shown_ = true;
+
+    ops[len++] = START;
+    ops[len++] = BYTE(0b01000000); // Write to display with automatic addressing
+    ops[len++] = STOP;
+
+    // Send each run of changed digits from its own address, so digits
+    // in between that haven't changed aren't sent again. At most three
+    // runs fit in six digits, which is 19 ops in all.
+    int i = 0;
+    while (i < max_chars_) {
+        if (!changed[i]) {
+            i++;
+            continue;
+        }
+        ops[len++] = START;
+        ops[len++] = BYTE(0xC0 | i); // Address of first digit in the run
+        while (i < max_chars_ && changed[i]) {
+            ops[len++] = BYTE(Encode(i));
+            i++;
         }
-        break;
+        ops[len++] = STOP;
     }
-    t->counter_++;
-}
 
-void TM1637::Start() {
-    counter_ = 0;
+    ops[len++] = START;
+    ops[len++] = BYTE(0b10001000 | brightness_); // Display on, pulse width from level
+    ops[len++] = STOP;
 
-    // Task notification setup
-    const TickType_t max_block_time = pdMS_TO_TICKS(MAX_SEND_TIMEOUT);
+    return len;
+}
 
-    // Set of the timer
-    hw_timer_init(StartISR, this);
-    hw_timer_alarm_us(CLK_DELAY, true);
+int TM1637::Submit(const uint16_t* ops, int len) {
+    int slot = bus_->Submit(
+        channel_,
+        ops,
+        len,
+        pdMS_TO_TICKS(MAX_SEND_TIMEOUT)
+    );
+    if (slot < 0) {
+        ESP_LOGE(TAG_, "Failed to queue write to display");
+        // The frame was never sent so rewrite every digit next time
+        shown_ = false;
+        return slot;
+    }
 
-    // Wait until finished writing to display
-    int result = xSemaphoreTake(write_semaphore_, max_block_time);
+    portENTER_CRITICAL();
+    if (pending_++ == 0) {
+        busy_start_ = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL();
+    return slot;
+}
 
-    if (result != pdTRUE) {
+bool TM1637::Finish(int slot) {
+    if (slot < 0) {
+        return false;
+    }
+    bool sent = bus_->Wait(channel_, slot, pdMS_TO_TICKS(MAX_SEND_TIMEOUT));
+    Done();
+    if (!sent) {
         ESP_LOGE(
             TAG_,
-            "Failed to send start. Function timed out after 200ms"
+            "Failed to write to display. Function timed out after 200ms"
         );
+        // Don't know how much of the frame arrived so rewrite every
+        // digit next time
+        xSemaphoreTake(bus_mutex_, portMAX_DELAY);
+        shown_ = false;
+        xSemaphoreGive(bus_mutex_);
+        return false;
     }
-
-    hw_timer_deinit();
+    return true;
 }
 
-void TM1637::StartISR(void* arg) {
-    TM1637* t = (TM1637*)arg;
-    if (t->counter_ % 2 == 0) {
-        gpio_set_level(t->dio_, 0);
+void TM1637::Done() {
+    // The bus is busy from when the first of a run of transfers is
+    // queued until the last one is sent. Transfers queued behind each
+    // other overlap, so count the run as a whole rather than each one.
+    // The time is added to the total for the second the run started in.
+    // Several tasks and timers can write so keep the totals consistent.
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL();
+    if (--pending_ > 0) {
+        portEXIT_CRITICAL();
+        return;
     }
-    else {
-        // Note, there is no need to set clock to low here as this is
-        // done first thing when sending a byte. All we do here is give
-        // back the semaphore to continue execution.
-        BaseType_t higher_priority_task_woken = pdFALSE;
-        xSemaphoreGiveFromISR(
-            t->write_semaphore_,
-            &higher_priority_task_woken
-        );
-        portEND_SWITCHING_ISR(higher_priority_task_woken);
+    int64_t busy = now - busy_start_;
+    int64_t second = busy_start_ / 1000000;
+    if (second != busy_second_) {
+        if (busy_second_ >= 0) {
+            if (busy_us_ > busy_max_us_) {
+                busy_max_us_ = busy_us_;
+            }
+            busy_total_us_ += busy_us_;
+            busy_seconds_++;
+        }
+        busy_second_ = second;
+        busy_us_ = 0;
     }
-    t->counter_++;
+    busy_us_ += busy;
+    portEXIT_CRITICAL();
 }
 
-void TM1637::Stop() {
-    counter_ = 0;
+TM1637::TM1637(
+    int dio,
+    int clk,
+    int len,
+    DisplayBus* bus
+):Segment((len < kMaxDigits) ? len : kMaxDigits) {
+    dio_ = (gpio_num_t)dio;
+    clk_ = (gpio_num_t)clk;
+    bus_ = bus;
 
-    // Task notification setup
-    const TickType_t max_block_time = pdMS_TO_TICKS(MAX_SEND_TIMEOUT);
+    // Create our semaphore that will be used later
+    bus_mutex_ = xSemaphoreCreateMutex();
 
-    // Set of the timer
-    hw_timer_init(StopISR, this);
-    hw_timer_alarm_us(CLK_DELAY, true);
+    Init();
+}
 
-    // Wait until finished writing to display
-    int result = xSemaphoreTake(write_semaphore_, max_block_time);
+void TM1637::Write(char* msg) {
+    uint16_t ops[DISPLAY_BUS_MAX_OPS];
+    int len = 0;
+    char frame[sizeof(frame_)];
 
-    if (result != pdTRUE) {
-        ESP_LOGE(
-            TAG_,
-            "Failed to send start. Function timed out after 200ms"
-        );
-    }
+    xSemaphoreTake(bus_mutex_, portMAX_DELAY);
 
-    hw_timer_deinit();
-}
+    len = Build(ops, msg, false);
+    int slot = Submit(ops, len);
+    memcpy(frame, frame_, sizeof(frame));
 
-void TM1637::StopISR(void* arg) {
-    TM1637* t = (TM1637*)arg;
+    // Let others queue up behind us while this is sent
+    xSemaphoreGive(bus_mutex_);
 
-    switch (t->counter_ % 4) {
-    case 0: // Clock falling
-        gpio_set_level(t->clk_, 0);
-        break;
-    case 1: // Clock low, data is still low from ack
-        break;
-    case 2: // Clock goes high
-        gpio_set_level(t->clk_, 1);
-        break;
-    case 3: // Clock is now high, data can go high
-        gpio_set_level(t->dio_, 1);
-        BaseType_t higher_priority_task_woken = pdFALSE;
-        xSemaphoreGiveFromISR(
-            t->write_semaphore_,
-            &higher_priority_task_woken
-        );
-        portEND_SWITCHING_ISR(higher_priority_task_woken);
-        break;
+    if (Finish(slot) && on_commit_ != NULL) {
+        on_commit_(frame, max_chars_, on_commit_arg_);
     }
-    t->counter_++;
 }
 
-TM1637::TM1637(int dio, int clk):Segment(6) {
-    dio_ = (gpio_num_t)dio;
-    clk_ = (gpio_num_t)clk;
+void TM1637::Stage(const char* msg) {
+    xSemaphoreTake(bus_mutex_, portMAX_DELAY);
+    memcpy(staged_, msg, max_chars_);
+    has_staged_ = true;
+    xSemaphoreGive(bus_mutex_);
+}
 
-    // Create our semaphore that will be used later
-    write_semaphore_ = xSemaphoreCreateBinary();
+void TM1637::SetBrightness(int level) {
+    if (level < 0) {
+        level = 0;
+    }
+    else if (level > 7) {
+        level = 7;
+    }
+    brightness_ = level;
+}
 
-    Init();
+int TM1637::Brightness() {
+    return brightness_;
 }
 
-void TM1637::Write(char* msg) {
-    Start();
-    SendByte(0b01000000); // Write to display with automatic addressing
-    Stop();
+void TM1637::SetOnCommit(
+    void (*callback)(const char* frame, int len, void* arg),
+    void* arg
+) {
+    on_commit_ = callback;
+    on_commit_arg_ = arg;
+}
 
-    Start();
-    SendByte(0xC0); // Address of first digit
+void TM1637::SetColon(bool on) {
+    uint16_t ops[DISPLAY_BUS_MAX_OPS] = {
+        START,
+        BYTE(0b01000100), // Write to display with fixed addressing
+        STOP,
+        START,
+        BYTE(0xC1), // Address of second digit
+        0, // Filled in below
+        STOP,
+    };
+    int len = 7;
+    char frame[sizeof(frame_)];
+    bool committed = false;
+
+    xSemaphoreTake(bus_mutex_, portMAX_DELAY);
+    bool colon_changed = colon_ != on;
+    colon_ = on;
+    if (has_staged_) {
+        // Send the staged frame and the colon in a single transfer
+        len = Build(ops, staged_, colon_changed);
+        has_staged_ = false;
+        committed = true;
+    }
+    else {
+        ops[5] = BYTE(Encode(1));
+    }
+    int slot = Submit(ops, len);
+    memcpy(frame, frame_, sizeof(frame));
+    xSemaphoreGive(bus_mutex_);
 
-    // Now send characters
-    for (int i = 0; i < sizeof(&msg) / sizeof(msg[0]); i++) {
-        /* TODO: Should probably check it is a valid char */
-        if (i == 1) {
-            // Include colon between hours and minutes
-            SendByte(digits_[(int)msg[i]] | digits_[16]);
-        }
-        else {
-            SendByte(digits_[(int)msg[i]]);
-        }
+    if (Finish(slot) && committed && on_commit_ != NULL) {
+        on_commit_(frame, max_chars_, on_commit_arg_);
     }
-    Stop();
+}
 
-    Start();
-    SendByte(0b10001111); // Display on, pulse width 14/16
-    Stop();
+int64_t TM1637::BusMaxUs() {
+    portENTER_CRITICAL();
+    int64_t max = busy_max_us_;
+    portEXIT_CRITICAL();
+    return max;
 }
 
-void TM1637::WaitForMsg(QueueHandle_t* queue) {
-    char msg[4];
+int64_t TM1637::BusMeanUs() {
+    portENTER_CRITICAL();
+    int64_t mean = (busy_seconds_ == 0) ? 0 : busy_total_us_ / busy_seconds_;
+    portEXIT_CRITICAL();
+    return mean;
+}
 
-    TickType_t last_wake;
-    last_wake = xTaskGetTickCount();
+void TM1637::WaitForMsg(QueueHandle_t* queue) {
+    // Large enough for any display. The queue decides how much is used
+    char msg[kMaxDigits];
 
     while (1) {
-        if (xQueueReceive(*queue, msg, 0) == pdTRUE) {
+        // Block until there is something to show rather than polling
+        if (xQueueReceive(*queue, msg, portMAX_DELAY) == pdTRUE) {
             ESP_LOGI(TAG_, "Writing %s to display", msg);
             Write(msg);
         }
-        vTaskDelayUntil(&last_wake, 100);
     }
 }
@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MDNS_RESPONDER_MDNS_RESPONDER_H_
+#define MDNS_RESPONDER_MDNS_RESPONDER_H_
+
+#include <stdint.h>
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+// A small mDNS responder.
+//
+// Answers A queries for <hostname>.local, plus PTR, SRV and TXT
+// queries for a handful of DNS-SD services. Everything is answered
+// from fixed records in the callback for incoming packets on the
+// TCP/IP task, so there is no task of its own and nothing is allocated
+// beyond the buffer lwIP sends each answer in. There is no probing or
+// conflict resolution as the names are fixed at build time.
+class MdnsResponder
+{
+private:
+    static const int kMaxServices = 4;
+    static const int kBufferSize = 512;
+
+    // Most names that can be pointed back to in one response. The
+    // announcement with kMaxServices services needs up to 16, and
+    // names past this are just sent uncompressed.
+    static const int kMaxNames = 16;
+
+    struct Service {
+        // Service type, e.g. _http._tcp.local
+        char type[32];
+        uint16_t port;
+        // TXT record data. A single string, may be empty
+        const char* txt;
+    };
+
+    // Our hostname including .local
+    char host_[64];
+
+    // Instance name used for all services
+    const char* instance_;
+
+    Service services_[kMaxServices];
+    int num_services_ = 0;
+
+    struct udp_pcb* pcb_ = NULL;
+
+    // Response being built and how much of it has been used
+    uint8_t buf_[kBufferSize];
+    int len_;
+    bool overflow_;
+
+    // Names written to the response so far, so later copies can be
+    // compressed to a pointer. dotted points in to one of our own
+    // names, so a suffix of it is a name too.
+    struct Name {
+        const char* label;
+        const char* dotted;
+        int offset;
+    };
+    Name names_[kMaxNames];
+    int num_names_;
+
+    // Set while answering a legacy unicast query, which limits the TTL
+    // and flags we may use
+    bool legacy_ = false;
+
+    // Number of announcements left to send
+    int announcements_ = 0;
+
+    // Tag to use for logging
+    const char TAG_[15] = "MDNS_RESPONDER";
+
+    // Append data to the response
+    void Put8(uint8_t value);
+    void Put16(uint16_t value);
+    void Put32(uint32_t value);
+
+    // Start a new response
+    void Reset();
+
+    // Offset of a name already in the response, or -1
+    int FindName(const char* label, const char* dotted);
+
+    // Append a name. label is written as a single label first if it is
+    // not NULL, followed by each dot separated part of dotted. Any
+    // part of the name already in the response is replaced by a
+    // pointer to it.
+    void PutName(const char* label, const char* dotted);
+
+    // Append the start of a record, leaving the data length to be
+    // filled in by EndRecord(). Returns the offset of the length.
+    int StartRecord(
+        const char* label,
+        const char* dotted,
+        uint16_t type,
+        bool unique,
+        uint32_t ttl
+    );
+    void EndRecord(int length_offset);
+
+    // Append each kind of record we serve
+    void PutA(const ip4_addr_t* ip, uint32_t ttl);
+    void PutServicesPtr(int service, uint32_t ttl);
+    void PutPtr(int service, uint32_t ttl);
+    void PutSrv(int service, uint32_t ttl);
+    void PutTxt(int service, uint32_t ttl);
+
+    // Is name the full instance name of service
+    bool IsInstance(const char* name, int service);
+
+    // Build an unsolicited response with all our records in buf_
+    void BuildAnnouncement(const ip4_addr_t* ip);
+
+    // Build and send a response to a query
+    void Answer(
+        struct pbuf* p,
+        const ip_addr_t* addr,
+        u16_t port,
+        const ip4_addr_t* ip
+    );
+
+    // Send the contents of buf_
+    void Send(const ip_addr_t* addr, u16_t port);
+
+    // Create the socket and join the mDNS group. Must run in the
+    // TCP/IP task
+    static void StartCallback(void* arg);
+
+    // Send an unsolicited response with all our records. Must run in
+    // the TCP/IP task
+    static void AnnounceCallback(void* arg);
+
+    // Start announcing again from the first of the announcements,
+    // replacing any still to be sent. Must run in the TCP/IP task
+    static void ReannounceCallback(void* arg);
+
+    // Callback for incoming packets
+    static void OnRecv(
+        void* arg,
+        struct udp_pcb* pcb,
+        struct pbuf* p,
+        const ip_addr_t* addr,
+        u16_t port
+    );
+
+public:
+    // Constructor. Set the hostname, without .local, and the instance
+    // name to advertise services under. The instance name must outlive
+    // the responder.
+    MdnsResponder(const char* hostname, const char* instance);
+
+    // Advertise a service, e.g. AddService("_http", "_tcp", 80). txt
+    // may be NULL and must outlive the responder. Must be called before
+    // Start(). Returns false if there is no room for the service or
+    // the announcement with it added wouldn't fit in one packet.
+    bool AddService(
+        const char* service,
+        const char* proto,
+        uint16_t port,
+        const char* txt = NULL
+    );
+
+    // Start answering queries and announce ourselves. Call once we
+    // have an IP address.
+    void Start();
+
+    // Announce our records again, e.g. after our address has changed
+    void Announce();
+};
+
+#endif  // MDNS_RESPONDER_MDNS_RESPONDER_H_
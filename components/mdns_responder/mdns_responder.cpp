@@ -0,0 +1,594 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "mdns_responder.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+#include "lwip/igmp.h"
+#include "lwip/ip.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+
+#define MDNS_PORT 5353
+
+// Record types
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define TYPE_TXT 16
+#define TYPE_SRV 33
+#define TYPE_ANY 255
+
+#define CLASS_IN 1
+
+// Top bit of the class. In a question it asks for a unicast reply, in
+// an answer it marks a record as unique to us
+#define CLASS_TOP_BIT 0x8000
+
+// Header flags for an authoritative response
+#define FLAGS_RESPONSE 0x8400
+
+// TTLs recommended by RFC 6762. Legacy queries get at most 10s
+#define TTL_HOST 120
+#define TTL_OTHER 4500
+#define TTL_LEGACY 10
+
+// Top two bits of a length byte that mark it as a pointer
+#define COMPRESSION_POINTER 0xC000
+
+// Longest name we will decode from a query
+#define MAX_NAME_LEN 128
+
+// Name that lists all service types
+#define SERVICES_NAME "_services._dns-sd._udp.local"
+
+// Gap between announcements in ms
+#define ANNOUNCE_INTERVAL 1000
+
+// Read a possibly compressed name from msg at offset in to out as a dot
+// separated string. Returns the offset just after the name or -1 if it
+// is malformed or too long.
+static int read_name(
+    const uint8_t* msg,
+    int len,
+    int offset,
+    char* out,
+    int out_len
+) {
+    int end = -1;
+    int out_pos = 0;
+    int jumps = 0;
+
+    while (offset < len) {
+        uint8_t label_len = msg[offset];
+
+        if (label_len == 0) {
+            out[out_pos] = '\0';
+            return (end < 0) ? offset + 1 : end;
+        }
+
+        if ((label_len & 0xC0) == 0xC0) {
+            // Pointer to a name earlier in the message. Limit how many
+            // we follow so a loop can't hang us
+            if (offset + 1 >= len || ++jumps > 8) {
+                return -1;
+            }
+            if (end < 0) {
+                end = offset + 2;
+            }
+            offset = ((label_len & 0x3F) << 8) | msg[offset + 1];
+            continue;
+        }
+
+        if ((label_len & 0xC0) != 0
+            || offset + 1 + label_len > len
+            || out_pos + label_len + 2 > out_len) {
+            return -1;
+        }
+
+        if (out_pos != 0) {
+            out[out_pos++] = '.';
+        }
+        memcpy(out + out_pos, msg + offset + 1, label_len);
+        out_pos += label_len;
+        offset += 1 + label_len;
+    }
+    return -1;
+}
+
+static uint16_t get16(const uint8_t* buf) {
+    return (buf[0] << 8) | buf[1];
+}
+
+static int count_bits(uint8_t mask) {
+    int count = 0;
+    for (; mask != 0; mask >>= 1) {
+        count += mask & 1;
+    }
+    return count;
+}
+
+void MdnsResponder::Put8(uint8_t value) {
+    if (len_ >= kBufferSize) {
+        overflow_ = true;
+        return;
+    }
+    buf_[len_++] = value;
+}
+
+void MdnsResponder::Put16(uint16_t value) {
+    Put8(value >> 8);
+    Put8(value);
+}
+
+void MdnsResponder::Put32(uint32_t value) {
+    Put16(value >> 16);
+    Put16(value);
+}
+
+void MdnsResponder::Reset() {
+    len_ = 0;
+    overflow_ = false;
+    num_names_ = 0;
+}
+
+int MdnsResponder::FindName(const char* label, const char* dotted) {
+    for (int i = 0; i < num_names_; i++) {
+        const Name* n = &names_[i];
+        bool same_label = (label == NULL)
+            ? n->label == NULL
+            : n->label != NULL && strcasecmp(label, n->label) == 0;
+        if (same_label && strcasecmp(dotted, n->dotted) == 0) {
+            return n->offset;
+        }
+    }
+    return -1;
+}
+
+void MdnsResponder::PutName(const char* label, const char* dotted) {
+    while (label != NULL || *dotted != '\0') {
+        int offset = FindName(label, dotted);
+        if (offset >= 0) {
+            Put16(COMPRESSION_POINTER | offset);
+            return;
+        }
+
+        // Remember where this part starts so later names can point to it
+        if (num_names_ < kMaxNames && !overflow_) {
+            names_[num_names_].label = label;
+            names_[num_names_].dotted = dotted;
+            names_[num_names_].offset = len_;
+            num_names_++;
+        }
+
+        const char* part;
+        int len;
+        if (label != NULL) {
+            part = label;
+            len = strlen(label);
+            label = NULL;
+        }
+        else {
+            const char* dot = strchr(dotted, '.');
+            part = dotted;
+            len = (dot != NULL) ? dot - dotted : strlen(dotted);
+            dotted += len;
+            if (*dotted == '.') {
+                dotted++;
+            }
+        }
+
+        Put8(len);
+        for (int i = 0; i < len; i++) {
+            Put8(part[i]);
+        }
+    }
+    Put8(0);
+}
+
+int MdnsResponder::StartRecord(
+    const char* label,
+    const char* dotted,
+    uint16_t type,
+    bool unique,
+    uint32_t ttl
+) {
+    // Legacy resolvers don't understand the cache flush bit
+    if (legacy_) {
+        unique = false;
+        ttl = (ttl > TTL_LEGACY) ? TTL_LEGACY : ttl;
+    }
+
+    PutName(label, dotted);
+    Put16(type);
+    Put16(unique ? (CLASS_IN | CLASS_TOP_BIT) : CLASS_IN);
+    Put32(ttl);
+
+    int length_offset = len_;
+    Put16(0);
+    return length_offset;
+}
+
+void MdnsResponder::EndRecord(int length_offset) {
+    if (overflow_) {
+        return;
+    }
+    int length = len_ - length_offset - 2;
+    buf_[length_offset] = length >> 8;
+    buf_[length_offset + 1] = length;
+}
+
+void MdnsResponder::PutA(const ip4_addr_t* ip, uint32_t ttl) {
+    int length = StartRecord(NULL, host_, TYPE_A, true, ttl);
+    // Already in network order
+    uint32_t addr = ip4_addr_get_u32(ip);
+    const uint8_t* bytes = (const uint8_t*)&addr;
+    for (int i = 0; i < 4; i++) {
+        Put8(bytes[i]);
+    }
+    EndRecord(length);
+}
+
+void MdnsResponder::PutServicesPtr(int service, uint32_t ttl) {
+    int length = StartRecord(NULL, SERVICES_NAME, TYPE_PTR, false, ttl);
+    PutName(NULL, services_[service].type);
+    EndRecord(length);
+}
+
+void MdnsResponder::PutPtr(int service, uint32_t ttl) {
+    Service* s = &services_[service];
+    int length = StartRecord(NULL, s->type, TYPE_PTR, false, ttl);
+    PutName(instance_, s->type);
+    EndRecord(length);
+}
+
+void MdnsResponder::PutSrv(int service, uint32_t ttl) {
+    Service* s = &services_[service];
+    int length = StartRecord(instance_, s->type, TYPE_SRV, true, ttl);
+    Put16(0); // Priority
+    Put16(0); // Weight
+    Put16(s->port);
+    PutName(NULL, host_);
+    EndRecord(length);
+}
+
+void MdnsResponder::PutTxt(int service, uint32_t ttl) {
+    Service* s = &services_[service];
+    int length = StartRecord(instance_, s->type, TYPE_TXT, true, ttl);
+    int txt_len = (s->txt != NULL) ? strlen(s->txt) : 0;
+    // An empty TXT record still needs a single empty string
+    Put8(txt_len);
+    for (int i = 0; i < txt_len; i++) {
+        Put8(s->txt[i]);
+    }
+    EndRecord(length);
+}
+
+bool MdnsResponder::IsInstance(const char* name, int service) {
+    int len = strlen(instance_);
+    return strncasecmp(name, instance_, len) == 0
+        && name[len] == '.'
+        && strcasecmp(name + len + 1, services_[service].type) == 0;
+}
+
+void MdnsResponder::Answer(
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port,
+    const ip4_addr_t* ip
+) {
+    const uint8_t* msg = (const uint8_t*)p->payload;
+    int len = p->len;
+
+    if (len < 12 || p->next != NULL) {
+        return;
+    }
+
+    // Ignore responses and anything other than standard queries
+    uint16_t flags = get16(msg + 2);
+    if ((flags & 0x8000) != 0 || ((flags >> 11) & 0x0F) != 0) {
+        return;
+    }
+
+    // Work out which records have been asked for. Bit n of each mask
+    // is for service n.
+    bool want_a = false;
+    uint8_t want_meta = 0;
+    uint8_t want_ptr = 0;
+    uint8_t want_srv = 0;
+    uint8_t want_txt = 0;
+    bool unicast = false;
+
+    uint16_t questions = get16(msg + 4);
+    int offset = 12;
+    char name[MAX_NAME_LEN];
+
+    for (int i = 0; i < questions; i++) {
+        offset = read_name(msg, len, offset, name, sizeof(name));
+        if (offset < 0 || offset + 4 > len) {
+            return;
+        }
+        uint16_t type = get16(msg + offset);
+        uint16_t qclass = get16(msg + offset + 2);
+        offset += 4;
+
+        if ((qclass & CLASS_TOP_BIT) != 0) {
+            unicast = true;
+        }
+        qclass &= ~CLASS_TOP_BIT;
+        if (qclass != CLASS_IN && qclass != TYPE_ANY) {
+            continue;
+        }
+        bool any = type == TYPE_ANY;
+
+        if (strcasecmp(name, host_) == 0 && (type == TYPE_A || any)) {
+            want_a = true;
+        }
+        for (int s = 0; s < num_services_; s++) {
+            uint8_t bit = 1 << s;
+            if (type == TYPE_PTR || any) {
+                if (strcasecmp(name, SERVICES_NAME) == 0) {
+                    want_meta |= bit;
+                }
+                if (strcasecmp(name, services_[s].type) == 0) {
+                    want_ptr |= bit;
+                }
+            }
+            if (IsInstance(name, s)) {
+                if (type == TYPE_SRV || any) {
+                    want_srv |= bit;
+                }
+                if (type == TYPE_TXT || any) {
+                    want_txt |= bit;
+                }
+            }
+        }
+    }
+    int questions_end = offset;
+
+    if (!want_a && !want_meta && !want_ptr && !want_srv && !want_txt) {
+        return;
+    }
+
+    // Send along the records the asker will want next
+    uint8_t add_srv = want_ptr & ~want_srv;
+    uint8_t add_txt = want_ptr & ~want_txt;
+    bool add_a = !want_a && (want_ptr || want_srv);
+
+    // Queries not from port 5353 are from plain DNS resolvers. They
+    // need a unicast reply that echoes the ID and questions.
+    legacy_ = port != MDNS_PORT;
+    Reset();
+
+    Put16(legacy_ ? get16(msg) : 0);
+    Put16(FLAGS_RESPONSE);
+    Put16(legacy_ ? questions : 0);
+    Put16(want_a + count_bits(want_meta) + count_bits(want_ptr)
+        + count_bits(want_srv) + count_bits(want_txt));
+    Put16(0);
+    Put16(add_a + count_bits(add_srv) + count_bits(add_txt));
+
+    if (legacy_) {
+        // Names in the questions may point back at earlier questions.
+        // Our header is the same size as theirs so the pointers still
+        // work when copied as is.
+        for (int i = 12; i < questions_end; i++) {
+            Put8(msg[i]);
+        }
+    }
+
+    // Answers
+    if (want_a) {
+        PutA(ip, TTL_HOST);
+    }
+    for (int s = 0; s < num_services_; s++) {
+        uint8_t bit = 1 << s;
+        if (want_meta & bit) {
+            PutServicesPtr(s, TTL_OTHER);
+        }
+        if (want_ptr & bit) {
+            PutPtr(s, TTL_OTHER);
+        }
+        if (want_srv & bit) {
+            PutSrv(s, TTL_HOST);
+        }
+        if (want_txt & bit) {
+            PutTxt(s, TTL_OTHER);
+        }
+    }
+
+    // Additional records
+    for (int s = 0; s < num_services_; s++) {
+        uint8_t bit = 1 << s;
+        if (add_srv & bit) {
+            PutSrv(s, TTL_HOST);
+        }
+        if (add_txt & bit) {
+            PutTxt(s, TTL_OTHER);
+        }
+    }
+    if (add_a) {
+        PutA(ip, TTL_HOST);
+    }
+
+    if (legacy_ || unicast) {
+        Send(addr, port);
+    }
+    else {
+        ip_addr_t group;
+        IP_ADDR4(&group, 224, 0, 0, 251);
+        Send(&group, MDNS_PORT);
+    }
+}
+
+void MdnsResponder::BuildAnnouncement(const ip4_addr_t* ip) {
+    legacy_ = false;
+    Reset();
+
+    Put16(0);
+    Put16(FLAGS_RESPONSE);
+    Put16(0);
+    Put16(1 + num_services_ * 4);
+    Put16(0);
+    Put16(0);
+
+    PutA(ip, TTL_HOST);
+    for (int s = 0; s < num_services_; s++) {
+        PutServicesPtr(s, TTL_OTHER);
+        PutPtr(s, TTL_OTHER);
+        PutSrv(s, TTL_HOST);
+        PutTxt(s, TTL_OTHER);
+    }
+}
+
+void MdnsResponder::Send(const ip_addr_t* addr, u16_t port) {
+    if (overflow_) {
+        ESP_LOGE(TAG_, "Response too large for buffer");
+        return;
+    }
+
+    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len_, PBUF_RAM);
+    if (p == NULL) {
+        return;
+    }
+    pbuf_take(p, buf_, len_);
+    udp_sendto(pcb_, p, addr, port);
+    pbuf_free(p);
+}
+
+void MdnsResponder::OnRecv(
+    void* arg,
+    struct udp_pcb* pcb,
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port
+) {
+    MdnsResponder* r = (MdnsResponder*)arg;
+
+    // Answer with the address of the interface the query came in on
+    const ip4_addr_t* ip = netif_ip4_addr(ip_current_netif());
+    r->Answer(p, addr, port, ip);
+    pbuf_free(p);
+}
+
+void MdnsResponder::StartCallback(void* arg) {
+    MdnsResponder* r = (MdnsResponder*)arg;
+
+    r->pcb_ = udp_new();
+    if (r->pcb_ == NULL) {
+        ESP_LOGE(r->TAG_, "Failed to create socket");
+        return;
+    }
+
+    if (udp_bind(r->pcb_, IP_ADDR_ANY, MDNS_PORT) != ERR_OK) {
+        ESP_LOGE(r->TAG_, "Failed to bind to port %d", MDNS_PORT);
+        udp_remove(r->pcb_);
+        r->pcb_ = NULL;
+        return;
+    }
+
+    ip4_addr_t group;
+    IP4_ADDR(&group, 224, 0, 0, 251);
+    if (igmp_joingroup(IP4_ADDR_ANY4, &group) != ERR_OK) {
+        ESP_LOGE(r->TAG_, "Failed to join mDNS group");
+    }
+
+    // RFC 6762 requires an IP TTL of 255
+    udp_set_multicast_ttl(r->pcb_, 255);
+    udp_recv(r->pcb_, OnRecv, r);
+    ESP_LOGI(r->TAG_, "Responding to mDNS queries for %s", r->host_);
+
+    r->announcements_ = 2;
+    AnnounceCallback(r);
+}
+
+void MdnsResponder::AnnounceCallback(void* arg) {
+    MdnsResponder* r = (MdnsResponder*)arg;
+
+    if (r->pcb_ == NULL || netif_default == NULL || r->announcements_ <= 0) {
+        return;
+    }
+
+    const ip4_addr_t* ip = netif_ip4_addr(netif_default);
+    if (ip4_addr_isany_val(*ip)) {
+        return;
+    }
+
+    r->BuildAnnouncement(ip);
+
+    ip_addr_t group;
+    IP_ADDR4(&group, 224, 0, 0, 251);
+    r->Send(&group, MDNS_PORT);
+
+    // Announce a second time so that a lost packet doesn't matter
+    if (--r->announcements_ > 0) {
+        sys_timeout(ANNOUNCE_INTERVAL, AnnounceCallback, r);
+    }
+}
+
+void MdnsResponder::ReannounceCallback(void* arg) {
+    MdnsResponder* r = (MdnsResponder*)arg;
+
+    sys_untimeout(AnnounceCallback, r);
+    r->announcements_ = 2;
+    AnnounceCallback(r);
+}
+
+MdnsResponder::MdnsResponder(const char* hostname, const char* instance) {
+    snprintf(host_, sizeof(host_), "%s.local", hostname);
+    instance_ = instance;
+}
+
+bool MdnsResponder::AddService(
+    const char* service,
+    const char* proto,
+    uint16_t port,
+    const char* txt
+) {
+    if (num_services_ >= kMaxServices) {
+        ESP_LOGE(TAG_, "No room for service %s.%s", service, proto);
+        return false;
+    }
+
+    Service* s = &services_[num_services_];
+    int len = snprintf(
+        s->type, sizeof(s->type), "%s.%s.local", service, proto
+    );
+    if (len < 0 || len >= (int)sizeof(s->type)) {
+        ESP_LOGE(TAG_, "Service name %s.%s too long", service, proto);
+        return false;
+    }
+    s->port = port;
+    s->txt = txt;
+    num_services_++;
+
+    // Everything is sent in one announcement, which is the largest
+    // response we make. Build it with the new service to check it
+    // fits. Nothing else uses the buffer until Start().
+    ip4_addr_t ip;
+    IP4_ADDR(&ip, 255, 255, 255, 255);
+    BuildAnnouncement(&ip);
+    if (overflow_) {
+        ESP_LOGE(TAG_, "No room to announce service %s.%s", service, proto);
+        num_services_--;
+        return false;
+    }
+    return true;
+}
+
+void MdnsResponder::Start() {
+    // The raw lwIP API may only be used from the TCP/IP task
+    tcpip_callback(StartCallback, this);
+}
+
+void MdnsResponder::Announce() {
+    // announcements_ belongs to the TCP/IP task
+    tcpip_callback(ReannounceCallback, this);
+}
@@ -0,0 +1,59 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "event_loop.hpp"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Longest time the loop will sleep for when nothing is scheduled
+#define IDLE_WAIT_TICKS pdMS_TO_TICKS(1000)
+
+// Convert a time in ms to ticks, rounding up so timers never run early
+static uint32_t ms_to_ticks(uint32_t ms) {
+    return (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+void EventLoop::Run(void* arg) {
+    EventLoop* loop = (EventLoop*)arg;
+
+    for (;;) {
+        loop->wheel_.Advance(xTaskGetTickCount());
+
+        uint32_t wait = loop->wheel_.TicksUntilNext();
+        if (wait > IDLE_WAIT_TICKS) {
+            wait = IDLE_WAIT_TICKS;
+        }
+
+        // Measure the wait from the tick the wheel last processed, not
+        // from now, so time spent in callbacks doesn't make us late
+        TickType_t last_wake = loop->wheel_.Now();
+        vTaskDelayUntil(&last_wake, wait);
+    }
+}
+
+EventLoop::EventLoop():wheel_(xTaskGetTickCount()) {
+}
+
+void EventLoop::Schedule(Timer* t, uint32_t delay_ms, uint32_t period_ms) {
+    wheel_.Schedule(t, ms_to_ticks(delay_ms), ms_to_ticks(period_ms));
+}
+
+void EventLoop::Cancel(Timer* t) {
+    wheel_.Cancel(t);
+}
+
+void EventLoop::Start(
+    const char* name,
+    uint32_t stack_size,
+    UBaseType_t priority
+) {
+    ESP_LOGI(TAG_, "Starting event loop %s", name);
+
+    // The wheel started counting when the loop was created, which can
+    // be long before now if we were waiting for WiFi or provisioning.
+    // Count delays from now instead so nothing starts out overdue.
+    wheel_.Rebase(xTaskGetTickCount());
+    xTaskCreate(Run, name, stack_size, this, priority, &task_);
+}
@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SCHEDULER_EVENT_LOOP_H_
+#define SCHEDULER_EVENT_LOOP_H_
+
+#include <stdint.h>
+
+#include "timer_wheel.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Runs timer callbacks from a TimerWheel on a single FreeRTOS task,
+// driven by the RTOS tick. The task sleeps until the next timer is due
+// rather than polling.
+//
+// Timers may only be scheduled or cancelled before the loop is started
+// or from within callbacks running on the loop.
+class EventLoop
+{
+private:
+    TimerWheel wheel_;
+
+    // Task the loop is running on
+    TaskHandle_t task_ = NULL;
+
+    // Tag to use for logging
+    const char TAG_[11] = "EVENT_LOOP";
+
+    // Task entry point
+    static void Run(void* arg);
+
+public:
+    // Constructor
+    EventLoop();
+
+    // Schedule a timer to run after delay_ms and then every period_ms
+    // if period_ms is not 0
+    void Schedule(Timer* t, uint32_t delay_ms, uint32_t period_ms = 0);
+
+    // Cancel a timer
+    void Cancel(Timer* t);
+
+    // Start running the loop on a new task. Delays of timers scheduled
+    // before this are counted from here.
+    void Start(const char* name, uint32_t stack_size, UBaseType_t priority);
+};
+
+#endif  // SCHEDULER_EVENT_LOOP_H_
@@ -0,0 +1,127 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SCHEDULER_TIMER_WHEEL_H_
+#define SCHEDULER_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+// Note, nothing in here depends on the SDK so that the wheel can be
+// built and driven with a virtual tick source on a host machine.
+
+class TimerWheel;
+
+// A timer that can be scheduled on a TimerWheel. Timers are intrusive
+// so scheduling one never allocates. The timer must outlive its time
+// on the wheel.
+class Timer
+{
+private:
+    friend class TimerWheel;
+
+    // Function to call when the timer expires
+    void (*callback_)(void* arg);
+    void* arg_;
+
+    // Tick at which the timer is due
+    uint32_t deadline_ = 0;
+
+    // Period in ticks. 0 for one shot timers
+    uint32_t period_ = 0;
+
+    // Links for the list the timer is currently on
+    Timer* next_ = nullptr;
+    Timer* prev_ = nullptr;
+    Timer** list_ = nullptr;
+
+public:
+    // Constructor. Set the function to call when the timer expires
+    Timer(void (*callback)(void* arg), void* arg);
+
+    // Is the timer currently scheduled
+    bool Active();
+};
+
+// Hierarchical timer wheel.
+//
+// Level 0 has one slot per tick. Each level above covers 64 times the
+// span of the one below and its timers are cascaded down a level each
+// time the level below wraps, so scheduling and cancelling are O(1) and
+// a tick only touches the slots that are due. Expired timers are run
+// in deadline order, so a late Advance() still runs callbacks in the
+// order they were due.
+class TimerWheel
+{
+private:
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+    static const int kLevels = 4;
+
+    // Slots for each level. Each slot is the head of a list of timers
+    Timer* slots_[kLevels][kSlots];
+
+    // Timers that have expired in the tick currently being processed
+    Timer* expired_ = nullptr;
+
+    // Last tick that has been processed
+    uint32_t now_;
+
+    // Tick the current call to Advance() is catching up to. Periodic
+    // timers that are run late are re-armed relative to this so they
+    // don't run back to back for every period that was missed.
+    uint32_t target_;
+
+    // Number of timers on the wheel
+    int count_ = 0;
+
+    // Add a timer to the list at head
+    static void Link(Timer** head, Timer* t);
+
+    // Remove a timer from whichever list it is on
+    static void Unlink(Timer* t);
+
+    // Place a timer in the slot for its deadline. cascading is set when
+    // called part way through processing a tick.
+    void Insert(Timer* t, bool cascading);
+
+    // Move timers in a slot of the given level down to the levels below
+    void Cascade(int level);
+
+    // Process a single tick. Returns the number of callbacks run
+    int Tick();
+
+public:
+    // Constructor. Set the tick the wheel starts at
+    TimerWheel(uint32_t now);
+
+    // Schedule a timer to expire after delay ticks. If period is not 0
+    // the timer is re-armed every period ticks, measured from when it
+    // was due rather than when it ran so that it does not drift.
+    // Scheduling an active timer reschedules it.
+    void Schedule(Timer* t, uint32_t delay, uint32_t period = 0);
+
+    // Cancel a timer. Does nothing if the timer is not active
+    void Cancel(Timer* t);
+
+    // Run all timers due up to and including the tick now. Ticks with
+    // nothing due are skipped over rather than processed one by one.
+    // A periodic timer runs at most once per call, however far behind
+    // it is. Returns the number of callbacks run.
+    int Advance(uint32_t now);
+
+    // Move the wheel to tick now without running anything. Timers keep
+    // the delay they had left, so it is as if the ticks in between
+    // never happened.
+    void Rebase(uint32_t now);
+
+    // Number of ticks that can pass before Advance() needs to be called
+    // again. This is exact when the next timer is within one rotation
+    // of level 0, otherwise it is the time until the next cascade.
+    // Returns UINT32_MAX when no timers are scheduled.
+    uint32_t TicksUntilNext();
+
+    // Last tick processed
+    uint32_t Now();
+};
+
+#endif  // SCHEDULER_TIMER_WHEEL_H_
@@ -0,0 +1,215 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "timer_wheel.hpp"
+
+#include <stdint.h>
+
+Timer::Timer(void (*callback)(void* arg), void* arg) {
+    callback_ = callback;
+    arg_ = arg;
+}
+
+bool Timer::Active() {
+    return list_ != nullptr;
+}
+
+void TimerWheel::Link(Timer** head, Timer* t) {
+    t->prev_ = nullptr;
+    t->next_ = *head;
+    if (*head != nullptr) {
+        (*head)->prev_ = t;
+    }
+    *head = t;
+    t->list_ = head;
+}
+
+void TimerWheel::Unlink(Timer* t) {
+    if (t->prev_ != nullptr) {
+        t->prev_->next_ = t->next_;
+    }
+    else {
+        *t->list_ = t->next_;
+    }
+    if (t->next_ != nullptr) {
+        t->next_->prev_ = t->prev_;
+    }
+    t->next_ = nullptr;
+    t->prev_ = nullptr;
+    t->list_ = nullptr;
+}
+
+void TimerWheel::Insert(Timer* t, bool cascading) {
+    // Anything already due goes in the next tick to be processed.
+    // Cascades happen before the level 0 slot for now_ is processed so
+    // timers due this tick can still go in that slot.
+    int32_t delta = (int32_t)(t->deadline_ - now_);
+    uint32_t deadline = t->deadline_;
+    if (delta < 0 || (delta == 0 && !cascading)) {
+        deadline = cascading ? now_ : now_ + 1;
+    }
+    uint32_t span = deadline - now_;
+
+    int level = 0;
+    while (level < kLevels - 1 && span >= (1u << (kSlotBits * (level + 1)))) {
+        level++;
+    }
+
+    // Beyond the top level, park the timer in the furthest slot. It is
+    // re-inserted with its real deadline when that slot cascades.
+    uint32_t max_span = 1u << (kSlotBits * kLevels);
+    if (span >= max_span) {
+        deadline = now_ + max_span - 1;
+    }
+
+    int slot = (deadline >> (kSlotBits * level)) & (kSlots - 1);
+    Link(&slots_[level][slot], t);
+}
+
+void TimerWheel::Cascade(int level) {
+    int slot = (now_ >> (kSlotBits * level)) & (kSlots - 1);
+    Timer* t = slots_[level][slot];
+    slots_[level][slot] = nullptr;
+
+    while (t != nullptr) {
+        Timer* next = t->next_;
+        t->list_ = nullptr;
+        Insert(t, true);
+        t = next;
+    }
+}
+
+int TimerWheel::Tick() {
+    int ran = 0;
+    now_++;
+
+    // When a level wraps, pull the next slot of the level above down
+    for (int level = 1; level < kLevels; level++) {
+        if ((now_ & ((1u << (kSlotBits * level)) - 1)) != 0) {
+            break;
+        }
+        Cascade(level);
+    }
+
+    // Everything in this level 0 slot is due now. Move it to the
+    // expired list first so that callbacks can freely schedule and
+    // cancel timers, including ones that are about to run.
+    int slot = now_ & (kSlots - 1);
+    while (slots_[0][slot] != nullptr) {
+        Timer* t = slots_[0][slot];
+        Unlink(t);
+        Link(&expired_, t);
+    }
+
+    while (expired_ != nullptr) {
+        Timer* t = expired_;
+        Unlink(t);
+        count_--;
+
+        if (t->period_ != 0) {
+            t->deadline_ += t->period_;
+            // If we have fallen more than a period behind, skip the
+            // missed expiries rather than running them back to back
+            while ((int32_t)(t->deadline_ - target_) <= 0) {
+                t->deadline_ += t->period_;
+            }
+            Insert(t, false);
+            count_++;
+        }
+
+        t->callback_(t->arg_);
+        ran++;
+    }
+    return ran;
+}
+
+TimerWheel::TimerWheel(uint32_t now) {
+    now_ = now;
+    target_ = now;
+    for (int level = 0; level < kLevels; level++) {
+        for (int slot = 0; slot < kSlots; slot++) {
+            slots_[level][slot] = nullptr;
+        }
+    }
+}
+
+void TimerWheel::Schedule(Timer* t, uint32_t delay, uint32_t period) {
+    Cancel(t);
+    // The current tick has already been processed so the soonest a
+    // timer can run is the next one
+    t->deadline_ = now_ + ((delay != 0) ? delay : 1);
+    t->period_ = period;
+    Insert(t, false);
+    count_++;
+}
+
+void TimerWheel::Cancel(Timer* t) {
+    if (t->Active()) {
+        Unlink(t);
+        count_--;
+    }
+}
+
+int TimerWheel::Advance(uint32_t now) {
+    int ran = 0;
+    target_ = now;
+
+    while ((int32_t)(now - now_) > 0) {
+        // Nothing is due before the next occupied slot or the next
+        // cascade, so jump straight to it
+        uint32_t skip = TicksUntilNext();
+        if (skip > now - now_) {
+            now_ = now;
+            break;
+        }
+        now_ += skip - 1;
+        ran += Tick();
+    }
+    return ran;
+}
+
+void TimerWheel::Rebase(uint32_t now) {
+    // Take every timer off the wheel, then put it back with the same
+    // time left relative to the new tick
+    Timer* pending = nullptr;
+    for (int level = 0; level < kLevels; level++) {
+        for (int slot = 0; slot < kSlots; slot++) {
+            while (slots_[level][slot] != nullptr) {
+                Timer* t = slots_[level][slot];
+                Unlink(t);
+                Link(&pending, t);
+            }
+        }
+    }
+
+    uint32_t old = now_;
+    now_ = now;
+    target_ = now;
+
+    while (pending != nullptr) {
+        Timer* t = pending;
+        Unlink(t);
+        t->deadline_ = now + (t->deadline_ - old);
+        Insert(t, false);
+    }
+}
+
+uint32_t TimerWheel::TicksUntilNext() {
+    if (count_ == 0) {
+        return UINT32_MAX;
+    }
+
+    // Search level 0 up to the point where it next wraps. After that
+    // a cascade is needed so that is the longest we can wait.
+    uint32_t until_wrap = kSlots - (now_ & (kSlots - 1));
+    for (uint32_t i = 1; i <= until_wrap; i++) {
+        if (slots_[0][(now_ + i) & (kSlots - 1)] != nullptr) {
+            return i;
+        }
+    }
+    return until_wrap;
+}
+
+uint32_t TimerWheel::Now() {
+    return now_;
+}
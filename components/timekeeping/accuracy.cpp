@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "accuracy.hpp"
+
+#include <stdint.h>
+
+#define SECONDS_PER_DAY 86400
+
+void DisplayAccuracy::Record(const char* digits, int len, int64_t committed_us) {
+    int32_t shown = (digits[0] * 10 + digits[1]) * 3600
+        + (digits[2] * 10 + digits[3]) * 60;
+    if (len >= 6) {
+        shown += digits[4] * 10 + digits[5];
+    }
+
+    // Only changes in what is shown are interesting. Rewriting the same
+    // frame says nothing about how quickly the display followed time.
+    // The first frame has nothing before it, so there is no change to
+    // measure.
+    if (shown == last_shown_ || last_shown_ < 0) {
+        last_shown_ = shown;
+        return;
+    }
+    last_shown_ = shown;
+
+    int64_t day_us = (int64_t)SECONDS_PER_DAY * 1000000;
+    int64_t now_us = committed_us % day_us;
+    int64_t error = now_us - (int64_t)shown * 1000000;
+
+    // Pick the nearest day, so a frame for 23:59 shown just after
+    // midnight counts as late rather than a day early
+    if (error > day_us / 2) {
+        error -= day_us;
+    }
+    else if (error < -day_us / 2) {
+        error += day_us;
+    }
+
+    if (error < 0) {
+        early_++;
+        error = -error;
+    }
+
+    int bucket = error / kBucketUs;
+    if (bucket >= kBuckets) {
+        bucket = kBuckets - 1;
+    }
+    buckets_[bucket]++;
+    count_++;
+
+    if (error > max_error_us_) {
+        max_error_us_ = error;
+    }
+}
+
+int64_t DisplayAccuracy::PercentileUs(int p) {
+    if (count_ == 0) {
+        return 0;
+    }
+
+    // Rank of the sample we want, rounding up
+    uint32_t rank = ((uint64_t)count_ * p + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < kBuckets - 1; i++) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            int64_t edge = (i + 1) * kBucketUs;
+            return (edge < max_error_us_) ? edge : max_error_us_;
+        }
+    }
+    return max_error_us_;
+}
+
+int64_t DisplayAccuracy::MaxErrorUs() {
+    return max_error_us_;
+}
+
+uint32_t DisplayAccuracy::Count() {
+    return count_;
+}
+
+uint32_t DisplayAccuracy::Early() {
+    return early_;
+}
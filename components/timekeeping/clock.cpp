@@ -3,45 +3,205 @@
 
 #include "clock.hpp"
 
+#include <ctype.h>
+#include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include "esp_log.h"
-#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 #include "lwip/apps/sntp.h"
 #include "lwip/inet.h"
+#include "lwip/tcpip.h"
+
+// Record of SNTP setting the clock. Written from the TCP/IP task and
+// read from anywhere, so only touched in a critical section.
+static struct {
+    // Number of times the clock has been set
+    int count;
+
+    // Wall clock time it was last set to
+    time_t last;
+
+    // Size of the last correction in milliseconds
+    int64_t last_step_ms;
+} sync_stats;
+
+const char* const Clock::kDefaultServer = "pool.ntp.org";
+
+// The component is linked with --wrap=settimeofday so that calls from
+// SNTP come here first. SNTP sets the clock on every successful poll,
+// even when the correction is tiny, so this sees every sync.
+extern "C" int __real_settimeofday(
+    const struct timeval* tv,
+    const struct timezone* tz
+);
+
+extern "C" int __wrap_settimeofday(
+    const struct timeval* tv,
+    const struct timezone* tz
+) {
+    struct timeval before;
+    gettimeofday(&before, NULL);
+    int ret = __real_settimeofday(tv, tz);
+    if (ret == 0 && tv != NULL) {
+        Clock::RecordSync(&before, tv);
+    }
+    return ret;
+}
 
 void Clock::InitSNTP() {
     ESP_LOGI(TAG_, "Initialising SNTP");
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, ntp_server_name_);
+    sntp_setservername(0, sntp_server_);
     sntp_init();
     ESP_LOGI(
         TAG_,
         "Started SNTP client. Polling with interval %d ms. Using server %s.",
         sntp_get_sync_interval(),
-        ntp_server_name_
+        sntp_server_
     );
 }
 
+void Clock::RestartSNTP(void* arg) {
+    Clock* c = (Clock*)arg;
+
+    // Stop SNTP first so it isn't using the name while it changes
+    sntp_stop();
+    portENTER_CRITICAL();
+    strcpy(c->sntp_server_, c->server_);
+    portEXIT_CRITICAL();
+    c->InitSNTP();
+}
+
+int64_t Clock::EpochUs(const struct timeval* tv) {
+    return (int64_t)(uint32_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void Clock::RecordSync(
+    const struct timeval* before,
+    const struct timeval* after
+) {
+    int64_t step = EpochUs(after) - EpochUs(before);
+
+    portENTER_CRITICAL();
+    // The first sync is from the epoch so the size is meaningless
+    sync_stats.last_step_ms = (sync_stats.count == 0) ? 0 : step / 1000;
+    sync_stats.last = after->tv_sec;
+    sync_stats.count++;
+    int64_t step_ms = sync_stats.last_step_ms;
+    portEXIT_CRITICAL();
+
+    ESP_LOGI("CLOCK", "Clock set by SNTP (%lld ms)", step_ms);
+}
+
 Clock::Clock(const char* server) {
-    ntp_server_name_ = server;
-    InitSNTP();
+    if (!SetServer(server)) {
+        ESP_LOGE(
+            TAG_, "Invalid NTP server %s. Using %s", server, kDefaultServer
+        );
+        SetServer(kDefaultServer);
+    }
+}
+
+bool Clock::SetServer(const char* server) {
+    if (!IsValidServer(server)) {
+        return false;
+    }
+
+    portENTER_CRITICAL();
+    strcpy(server_, server);
+    portEXIT_CRITICAL();
+
+    // The lwIP API may only be used from the TCP/IP task
+    tcpip_callback(RestartSNTP, this);
+    return true;
+}
+
+void Clock::Server(char* server) {
+    portENTER_CRITICAL();
+    strcpy(server, server_);
+    portEXIT_CRITICAL();
+}
+
+bool Clock::IsValidServer(const char* server) {
+    // Labels of letters, digits and hyphens separated by dots. Labels
+    // can't be empty or start or end with a hyphen.
+    int label = 0;
+    for (int i = 0; i <= kMaxServerLen; i++) {
+        char c = server[i];
+        if (c == '\0' || c == '.') {
+            if (label == 0 || server[i - 1] == '-') {
+                return false;
+            }
+            if (c == '\0') {
+                return true;
+            }
+            label = 0;
+        }
+        else if (isalnum((unsigned char)c) || (c == '-' && label > 0)) {
+            label++;
+        }
+        else {
+            return false;
+        }
+    }
+
+    // Too long
+    return false;
 }
 
 int Clock::Hour() {
-    return (time_ / 3600) % 24;
+    return ((uint32_t)time_ / 3600) % 24;
 }
 
 int Clock::Minute() {
-    return (time_ / 60) % 60;
+    return ((uint32_t)time_ / 60) % 60;
 }
 
 int Clock::Second() {
-    return time_ % 60;
+    return (uint32_t)time_ % 60;
+}
+
+int Clock::Microsecond() {
+    return microsecond_;
 }
 
 time_t Clock::Now() {
-    time(&time_);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    time_ = tv.tv_sec;
+    microsecond_ = tv.tv_usec;
     return time_;
 }
 
+int64_t Clock::NowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return EpochUs(&tv);
+}
+
+bool Clock::Synced() {
+    return SyncCount() > 0;
+}
+
+int Clock::SyncCount() {
+    portENTER_CRITICAL();
+    int count = sync_stats.count;
+    portEXIT_CRITICAL();
+    return count;
+}
+
+time_t Clock::LastSync() {
+    portENTER_CRITICAL();
+    time_t last = sync_stats.last;
+    portEXIT_CRITICAL();
+    return last;
+}
+
+int64_t Clock::LastStepMs() {
+    portENTER_CRITICAL();
+    int64_t step = sync_stats.last_step_ms;
+    portEXIT_CRITICAL();
+    return step;
+}
@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMEKEEPING_ACCURACY_H_
+#define TIMEKEEPING_ACCURACY_H_
+
+#include <stdint.h>
+
+// Measures how far behind true time the display is.
+//
+// Each frame committed to the display is decoded back in to a time of
+// day and compared with the wall clock at the moment it was committed.
+// When the frame changes, the error is the time between the displayed
+// value becoming true and it actually being shown. Errors are kept in a
+// fixed histogram so percentiles can be reported without allocating.
+class DisplayAccuracy
+{
+private:
+    // Width of each histogram bucket in us (microseconds)
+    static const int64_t kBucketUs = 50000;
+    static const int kBuckets = 32;
+
+    // Histogram of error. The last bucket counts everything larger
+    uint32_t buckets_[kBuckets] = {0};
+
+    // Number of frames shown before the time they display
+    uint32_t early_ = 0;
+
+    // Total number of changed frames recorded
+    uint32_t count_ = 0;
+
+    int64_t max_error_us_ = 0;
+
+    // Time of day, in seconds, shown by the last frame
+    int32_t last_shown_ = -1;
+
+public:
+    // Record a frame. digits holds the characters sent to the display,
+    // hours first, either HHMM or HHMMSS depending on len.
+    // committed_us is the wall clock time the frame reached the
+    // display in microseconds since the epoch.
+    void Record(const char* digits, int len, int64_t committed_us);
+
+    // Error in us below which p percent of changed frames fall. This is
+    // the upper edge of the bucket the percentile lands in.
+    int64_t PercentileUs(int p);
+
+    // Largest error seen in us
+    int64_t MaxErrorUs();
+
+    // Number of changed frames recorded
+    uint32_t Count();
+
+    // Number of frames that were shown before the time they display
+    uint32_t Early();
+};
+
+#endif  // TIMEKEEPING_ACCURACY_H_
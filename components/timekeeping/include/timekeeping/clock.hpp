@@ -4,24 +4,66 @@
 #ifndef TIMEKEEPING_CLOCK_H_
 #define TIMEKEEPING_CLOCK_H_
 
+#include <stdint.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include "lwip/inet.h"
 
 class Clock
 {
+public:
+    // Longest NTP server name, not counting the terminator
+    static const int kMaxServerLen = 63;
+
+    // Server used when the one given isn't valid, so SNTP always runs
+    static const char* const kDefaultServer;
+
 private:
     time_t time_;
-    const char* ntp_server_name_;
+
+    // Microseconds into the current second as of the last call to Now()
+    int microsecond_ = 0;
+
+    // Server set by SetServer(). SNTP holds on to the name it is given,
+    // so this is copied to sntp_server_ with SNTP stopped, from the
+    // TCP/IP task.
+    char server_[kMaxServerLen + 1] = "";
+    char sntp_server_[kMaxServerLen + 1] = "";
+
     const char TAG_[6] = "CLOCK";
 
     // Initialise SNTP
     void InitSNTP();
 
+    // Restart SNTP with the server from server_. Must run in the TCP/IP
+    // task.
+    static void RestartSNTP(void* arg);
+
+    // Convert a wall clock time to microseconds since the epoch.
+    // time_t is 32 bits here so goes negative in 2038. Treating it as
+    // unsigned keeps the maths right until 2106.
+    static int64_t EpochUs(const struct timeval* tv);
+
 public:
-    // Start the clock and sync with the specified NTP server
+    // Start the clock and sync with the specified NTP server, or with
+    // kDefaultServer if it isn't valid
     Clock(const char* server);
 
+    // Change the NTP server and restart SNTP. The name is copied.
+    // Returns false if it isn't a valid server name.
+    bool SetServer(const char* server);
+
+    // Copy the NTP server currently in use in to server, which must
+    // have room for kMaxServerLen characters and the terminator. Safe
+    // to call while another task is calling SetServer().
+    void Server(char* server);
+
+    // Is server a host name or IPv4 address. Only letters, digits,
+    // hyphens and dots are allowed, which also makes the name safe to
+    // echo back in JSON.
+    static bool IsValidServer(const char* server);
+
     // Get the hour value of the clock.
     // To get the current hour, first make sure to update the
     // clock by calling Now()
@@ -37,8 +79,36 @@ public:
     // clock by calling Now()
     int Second();
 
+    // Get the number of microseconds into the current second.
+    // To get the current value, first make sure to update the
+    // clock by calling Now()
+    int Microsecond();
+
     // Get the current time now
     time_t Now();
+
+    // Get the current wall clock time in microseconds since the epoch.
+    // Useful for working out where we are within a second.
+    static int64_t NowUs();
+
+    // Has the clock been set by SNTP at least once
+    bool Synced();
+
+    // Number of times SNTP has set the clock
+    int SyncCount();
+
+    // Wall clock time SNTP last set the clock
+    time_t LastSync();
+
+    // Size of the last correction applied by SNTP in milliseconds
+    int64_t LastStepMs();
+
+    // Record that the wall clock has been set from before to after.
+    // Called for every settimeofday().
+    static void RecordSync(
+        const struct timeval* before,
+        const struct timeval* after
+    );
 };
 
 
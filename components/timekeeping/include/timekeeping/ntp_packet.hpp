@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMEKEEPING_NTP_PACKET_H_
+#define TIMEKEEPING_NTP_PACKET_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+
+// Building NTP packets, kept apart from the network code so it can be
+// tested off target.
+
+// Length of an NTP packet without extension fields
+#define NTP_PACKET_LEN 48
+
+#define NTP_LEAP_NONE 0
+#define NTP_LEAP_UNSYNC 3
+#define NTP_STRATUM_UNSYNC 16
+
+// Details of our clock that go in to every response
+struct NtpServerState {
+    // Stratum to report. 16 if not synchronised
+    uint8_t stratum;
+
+    // Leap indicator. 3 if not synchronised
+    uint8_t leap;
+
+    // Reference ID. Upstream IPv4 address in network order, or a kiss
+    // code when not synchronised
+    uint32_t reference_id;
+
+    // Root delay and dispersion in us (microseconds)
+    uint32_t root_delay_us;
+    uint32_t root_dispersion_us;
+
+    // Time the clock was last set
+    struct timeval reference;
+};
+
+// Build a response to request in response. Both must be at least
+// NTP_PACKET_LEN bytes long and may point at the same buffer. Returns
+// false if the request is not one we should answer.
+bool ntp_build_response(
+    const uint8_t* request,
+    uint8_t* response,
+    const NtpServerState* state,
+    const struct timeval* received
+);
+
+// Write the transmit timestamp in to a response built by
+// ntp_build_response()
+void ntp_set_transmit_time(uint8_t* response, const struct timeval* tv);
+
+#endif  // TIMEKEEPING_NTP_PACKET_H_
@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMEKEEPING_NTP_SERVER_H_
+#define TIMEKEEPING_NTP_SERVER_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "clock.hpp"
+#include "ntp_packet.hpp"
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+// Answers NTP requests on the local network so that one synchronised
+// clock can serve the rest.
+//
+// Requests are handled in the lwIP receive callback in the TCP/IP task.
+// The receive timestamp is the first thing taken when the callback runs
+// and the transmit timestamp is the last thing before sending. The
+// response is built in the request's buffer so nothing is allocated.
+class NtpServer
+{
+private:
+    Clock* clock_;
+    struct udp_pcb* pcb_ = NULL;
+
+    // Stratum of the server the clock syncs with
+    int upstream_stratum_;
+
+    // Estimate of the round trip delay to the reference clock and of
+    // upstream dispersion in ms
+    int root_delay_ms_;
+    int base_dispersion_ms_;
+
+    // Seconds after the last sync before we stop claiming to be synced
+    int max_age_;
+
+    // Number of requests answered
+    uint32_t requests_ = 0;
+
+    // Tag to use for logging
+    const char TAG_[11] = "NTP_SERVER";
+
+    // Work out what to report about our clock given the current time
+    void State(const struct timeval* now, NtpServerState* state);
+
+    // Create the socket. Must run in the TCP/IP task
+    static void StartCallback(void* arg);
+
+    // Callback for incoming packets
+    static void OnRecv(
+        void* arg,
+        struct udp_pcb* pcb,
+        struct pbuf* p,
+        const ip_addr_t* addr,
+        u16_t port
+    );
+
+public:
+    // Constructor. Set the clock to serve time from and how to describe
+    // it. The SNTP client doesn't report the stratum of its server or
+    // the quality of the path to it, so these have to be given.
+    // root_delay_ms is the round trip delay to the reference clock and
+    // base_dispersion_ms is an estimate of the error from upstream that
+    // dispersion grows from. After max_age seconds without a sync we
+    // report ourselves as unsynchronised.
+    NtpServer(
+        Clock* clock,
+        int upstream_stratum,
+        int root_delay_ms,
+        int base_dispersion_ms,
+        int max_age
+    );
+
+    // Start listening for requests
+    void Start();
+
+    // Number of requests answered
+    uint32_t Requests();
+};
+
+#endif  // TIMEKEEPING_NTP_SERVER_H_
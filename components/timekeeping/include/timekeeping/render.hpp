@@ -0,0 +1,15 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMEKEEPING_RENDER_H_
+#define TIMEKEEPING_RENDER_H_
+
+#include <stdint.h>
+
+// Fill digits with the time of day at a time given in seconds since
+// the epoch, hours first. len is 4 for HHMM or 6 for HHMMSS. seconds is
+// unsigned so a 32 bit time_t that has gone negative in 2038 still
+// renders correctly.
+void render_time(uint32_t seconds, char* digits, int len);
+
+#endif  // TIMEKEEPING_RENDER_H_
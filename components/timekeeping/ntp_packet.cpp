@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "ntp_packet.hpp"
+
+#include <string.h>
+#include <sys/time.h>
+
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+#define NTP_UNIX_OFFSET 2208988800UL
+
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+
+// log2 of the resolution of gettimeofday in seconds, about 1us
+#define NTP_PRECISION -20
+
+// Offsets of fields in an NTP packet
+#define NTP_OFFSET_STRATUM 1
+#define NTP_OFFSET_POLL 2
+#define NTP_OFFSET_PRECISION 3
+#define NTP_OFFSET_ROOT_DELAY 4
+#define NTP_OFFSET_ROOT_DISPERSION 8
+#define NTP_OFFSET_REFERENCE_ID 12
+#define NTP_OFFSET_REFERENCE 16
+#define NTP_OFFSET_ORIGINATE 24
+#define NTP_OFFSET_RECEIVE 32
+#define NTP_OFFSET_TRANSMIT 40
+
+// Write a 32 bit value in network order
+static void put_u32(uint8_t* buf, uint32_t value) {
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+// Write a time as an NTP timestamp. The seconds wrap in 2036 which is
+// what NTP expects, clients work out the era from their own clock.
+static void put_timestamp(uint8_t* buf, const struct timeval* tv) {
+    put_u32(buf, (uint32_t)tv->tv_sec + NTP_UNIX_OFFSET);
+    put_u32(buf + 4, (uint32_t)(((uint64_t)tv->tv_usec << 32) / 1000000));
+}
+
+// Convert us to NTP short format, 16.16 fixed point seconds
+static uint32_t to_short(uint32_t us) {
+    return (uint32_t)(((uint64_t)us << 16) / 1000000);
+}
+
+bool ntp_build_response(
+    const uint8_t* request,
+    uint8_t* response,
+    const NtpServerState* state,
+    const struct timeval* received
+) {
+    uint8_t version = (request[0] >> 3) & 0x07;
+    uint8_t mode = request[0] & 0x07;
+    if (mode != NTP_MODE_CLIENT || version < 1 || version > 4) {
+        return false;
+    }
+
+    // The client's transmit time comes back as our originate time. Copy
+    // it first as request and response may be the same buffer.
+    uint8_t originate[8];
+    memcpy(originate, request + NTP_OFFSET_TRANSMIT, sizeof(originate));
+    uint8_t poll = request[NTP_OFFSET_POLL];
+
+    memset(response, 0, NTP_PACKET_LEN);
+    response[0] = (state->leap << 6) | (version << 3) | NTP_MODE_SERVER;
+    response[NTP_OFFSET_STRATUM] = state->stratum;
+    response[NTP_OFFSET_POLL] = poll;
+    response[NTP_OFFSET_PRECISION] = (uint8_t)(int8_t)NTP_PRECISION;
+    put_u32(response + NTP_OFFSET_ROOT_DELAY, to_short(state->root_delay_us));
+    put_u32(
+        response + NTP_OFFSET_ROOT_DISPERSION,
+        to_short(state->root_dispersion_us)
+    );
+    memcpy(
+        response + NTP_OFFSET_REFERENCE_ID,
+        &state->reference_id,
+        sizeof(state->reference_id)
+    );
+    if (state->stratum != NTP_STRATUM_UNSYNC) {
+        put_timestamp(response + NTP_OFFSET_REFERENCE, &state->reference);
+    }
+    memcpy(response + NTP_OFFSET_ORIGINATE, originate, sizeof(originate));
+    put_timestamp(response + NTP_OFFSET_RECEIVE, received);
+    return true;
+}
+
+void ntp_set_transmit_time(uint8_t* response, const struct timeval* tv) {
+    put_timestamp(response + NTP_OFFSET_TRANSMIT, tv);
+}
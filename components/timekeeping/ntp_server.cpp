@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "ntp_server.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ntp_packet.hpp"
+
+#include "esp_log.h"
+#include "lwip/apps/sntp.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+#define NTP_PORT 123
+
+// Rate at which our dispersion grows once synced, in parts per million.
+// This is the tolerance assumed by the NTP specification.
+#define NTP_PHI_PPM 15
+
+void NtpServer::State(const struct timeval* now, NtpServerState* state) {
+    // Unsigned so that the age is still right once time_t wraps
+    int32_t age = (uint32_t)now->tv_sec - (uint32_t)clock_->LastSync();
+
+    // If the clock is behind the time of the last sync, treat it as just
+    // synced rather than wrapping the dispersion below
+    if (age < 0) {
+        age = 0;
+    }
+
+    if (!clock_->Synced() || age > max_age_) {
+        // Tell clients not to trust us
+        state->stratum = NTP_STRATUM_UNSYNC;
+        state->leap = NTP_LEAP_UNSYNC;
+        memcpy(&state->reference_id, "INIT", sizeof(state->reference_id));
+        state->root_delay_us = 0;
+        state->root_dispersion_us = 0;
+        state->reference.tv_sec = 0;
+        state->reference.tv_usec = 0;
+        return;
+    }
+
+    // The SNTP client doesn't tell us the stratum of the server it
+    // used, so we rely on the configured value
+    state->stratum = upstream_stratum_ + 1;
+    state->leap = NTP_LEAP_NONE;
+
+    state->reference_id = 0;
+    const ip_addr_t* upstream = sntp_getserver(0);
+    if (upstream != NULL && IP_IS_V4(upstream)) {
+        state->reference_id = ip4_addr_get_u32(ip_2_ip4(upstream));
+    }
+
+    // We don't know the delay or dispersion of the upstream server
+    // either, so report configured estimates of both. Dispersion grows
+    // with the drift allowed since we were last set, saturating rather
+    // than wrapping with a large base or maximum age.
+    state->root_delay_us = root_delay_ms_ * 1000;
+    uint64_t dispersion = (uint64_t)base_dispersion_ms_ * 1000
+        + (uint64_t)age * NTP_PHI_PPM;
+    state->root_dispersion_us = (dispersion > UINT32_MAX)
+        ? UINT32_MAX
+        : (uint32_t)dispersion;
+
+    state->reference.tv_sec = clock_->LastSync();
+    state->reference.tv_usec = 0;
+}
+
+void NtpServer::OnRecv(
+    void* arg,
+    struct udp_pcb* pcb,
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port
+) {
+    struct timeval received;
+    gettimeofday(&received, NULL);
+
+    NtpServer* s = (NtpServer*)arg;
+
+    // Requests are only ever a single small packet. Anything split
+    // over several buffers is not worth handling.
+    if (p->len < NTP_PACKET_LEN || p->next != NULL) {
+        pbuf_free(p);
+        return;
+    }
+
+    NtpServerState state;
+    s->State(&received, &state);
+
+    uint8_t* payload = (uint8_t*)p->payload;
+    if (!ntp_build_response(payload, payload, &state, &received)) {
+        pbuf_free(p);
+        return;
+    }
+
+    // Drop any extension fields the client sent
+    pbuf_realloc(p, NTP_PACKET_LEN);
+
+    struct timeval transmit;
+    gettimeofday(&transmit, NULL);
+    ntp_set_transmit_time(payload, &transmit);
+
+    udp_sendto(pcb, p, addr, port);
+    pbuf_free(p);
+    s->requests_++;
+}
+
+void NtpServer::StartCallback(void* arg) {
+    NtpServer* s = (NtpServer*)arg;
+
+    s->pcb_ = udp_new();
+    if (s->pcb_ == NULL) {
+        ESP_LOGE(s->TAG_, "Failed to create socket");
+        return;
+    }
+
+    if (udp_bind(s->pcb_, IP_ADDR_ANY, NTP_PORT) != ERR_OK) {
+        ESP_LOGE(s->TAG_, "Failed to bind to port %d", NTP_PORT);
+        udp_remove(s->pcb_);
+        s->pcb_ = NULL;
+        return;
+    }
+
+    udp_recv(s->pcb_, OnRecv, s);
+    ESP_LOGI(s->TAG_, "Serving time on port %d", NTP_PORT);
+}
+
+NtpServer::NtpServer(
+    Clock* clock,
+    int upstream_stratum,
+    int root_delay_ms,
+    int base_dispersion_ms,
+    int max_age
+) {
+    clock_ = clock;
+    upstream_stratum_ = upstream_stratum;
+    root_delay_ms_ = root_delay_ms;
+    base_dispersion_ms_ = base_dispersion_ms;
+    max_age_ = max_age;
+}
+
+void NtpServer::Start() {
+    // The raw lwIP API may only be used from the TCP/IP task
+    tcpip_callback(StartCallback, this);
+}
+
+uint32_t NtpServer::Requests() {
+    return requests_;
+}
@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "render.hpp"
+
+void render_time(uint32_t seconds, char* digits, int len) {
+    int hour = (seconds / 3600) % 24;
+    int minute = (seconds / 60) % 60;
+
+    digits[0] = hour / 10;
+    digits[1] = hour % 10;
+    digits[2] = minute / 10;
+    digits[3] = minute % 10;
+    if (len >= 6) {
+        digits[4] = (seconds % 60) / 10;
+        digits[5] = (seconds % 60) % 10;
+    }
+}
@@ -0,0 +1,91 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "boot_profile.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Names used in the summary. Must match the order of BootPhase
+static const char* const phase_names[BOOT_PHASE_COUNT] = {
+    "app_main",
+    "startup_delay",
+    "startup_info",
+    "nvs",
+    "events",
+    "wifi",
+    "provisioning",
+    "connected",
+    "mdns",
+    "first_frame",
+    "first_sync",
+};
+
+// Time each phase finished in us since boot. 0 if not yet reached
+static int64_t phase_times[BOOT_PHASE_COUNT];
+
+// Free heap in bytes when each phase finished
+static uint32_t phase_heap[BOOT_PHASE_COUNT];
+
+// Has the summary been logged
+static bool reported = false;
+
+void boot_profile_mark(BootPhase phase) {
+    int64_t now = esp_timer_get_time();
+    uint32_t heap = esp_get_free_heap_size();
+    bool report = false;
+
+    portENTER_CRITICAL();
+    if (phase_times[phase] == 0) {
+        phase_times[phase] = now;
+        phase_heap[phase] = heap;
+    }
+    if (!reported
+        && phase_times[BOOT_PHASE_FIRST_FRAME] != 0
+        && phase_times[BOOT_PHASE_FIRST_SYNC] != 0) {
+        reported = true;
+        report = true;
+    }
+    portEXIT_CRITICAL();
+
+    if (report) {
+        // Only ever used once so keep it off the caller's stack
+        static char summary[512];
+        boot_profile_format(summary, sizeof(summary));
+        ESP_LOGI("BOOT_PROFILE", "%s", summary);
+    }
+}
+
+int boot_profile_format(char* buf, size_t len) {
+    int written = snprintf(buf, len, "{");
+
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (written < 0 || (size_t)written >= len) {
+            return written;
+        }
+        int64_t ms = (phase_times[i] == 0) ? -1 : phase_times[i] / 1000;
+        int ret = snprintf(
+            buf + written, len - written,
+            "%s\"%s\":[%" PRId64 ",%" PRIu32 "]",
+            (i == 0) ? "" : ",",
+            phase_names[i],
+            ms,
+            phase_heap[i]
+        );
+        if (ret < 0) {
+            return ret;
+        }
+        written += ret;
+    }
+
+    if (written < 0 || (size_t)written >= len) {
+        return written;
+    }
+    return written + snprintf(buf + written, len - written, "}");
+}
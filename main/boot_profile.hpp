@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MAIN_BOOT_PROFILE_H_
+#define MAIN_BOOT_PROFILE_H_
+
+#include <stddef.h>
+
+// Points during boot that are timestamped. Each is marked when the
+// phase finishes.
+enum BootPhase {
+    BOOT_PHASE_APP_MAIN,  // Entered app_main
+    BOOT_PHASE_STARTUP_DELAY,  // CONFIG_STARTUP_DELAY has elapsed
+    BOOT_PHASE_STARTUP_INFO,  // Startup info logged
+    BOOT_PHASE_NVS,  // NVS initialised
+    BOOT_PHASE_EVENTS,  // Event loop created and handlers registered
+    BOOT_PHASE_WIFI,  // TCP/IP and WiFi initialised
+    BOOT_PHASE_PROVISIONING,  // Provisioning checked or started
+    BOOT_PHASE_CONNECTED,  // Got an IP address
+    BOOT_PHASE_MDNS,  // mDNS responder started
+    BOOT_PHASE_FIRST_FRAME,  // First frame written to the display
+    BOOT_PHASE_FIRST_SYNC,  // Clock first set by SNTP
+    BOOT_PHASE_COUNT
+};
+
+// Record that a phase has finished. Only the first call for each phase
+// is kept. Once the first frame and first sync have both been marked a
+// summary is logged. Safe to call from any task.
+void boot_profile_mark(BootPhase phase);
+
+// Write the boot profile to buf as a JSON object. Each phase is given
+// as a pair of the time in ms since boot that it finished, or -1 if it
+// has not happened yet, and the free heap in bytes at that point.
+// Returns the value from snprintf.
+int boot_profile_format(char* buf, size_t len);
+
+#endif // MAIN_BOOT_PROFILE_H_
@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "clock_task.hpp"
+
+#include <time.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "boot_profile.hpp"
+#include "timekeeping/render.hpp"
+
+void clock_tick(Clock* clock, char* frame) {
+    time_t now = clock->Now();
+    if (clock->Synced()) {
+        boot_profile_mark(BOOT_PHASE_FIRST_SYNC);
+    }
+    if (frame != NULL) {
+        render_time(now, frame, CLOCK_TASK_DIGITS);
+    }
+    ESP_LOGI(
+        "TIME", "%d:%d:%d",
+        clock->Hour(), clock->Minute(), clock->Second()
+    );
+}
+
+void task_clock(void* arg) {
+    ClockTaskArgs* args = (ClockTaskArgs*)arg;
+
+    // Some buffers for sending message to display
+    char msg[CLOCK_TASK_DIGITS];
+
+    for (;;) {
+        if (args->queue != NULL) {
+            clock_tick(args->clock, msg);
+            xQueueSend(args->queue, msg, 0);
+        }
+        else {
+            // With seconds shown the colon blink writes each frame
+            clock_tick(args->clock, NULL);
+        }
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+}
+
+void render_second(int64_t us, char* frame, void* arg) {
+    render_time(us / 1000000, frame, 6);
+}
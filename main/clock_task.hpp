@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MAIN_CLOCK_TASK_H_
+#define MAIN_CLOCK_TASK_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "timekeeping/clock.hpp"
+
+// Number of digits in the frames the clock task renders, HHMM
+#define CLOCK_TASK_DIGITS 4
+
+// What the clock task works with. Must outlive the task.
+struct ClockTaskArgs {
+    Clock* clock;
+
+    // Queue of frames for the display task, or NULL when the colon blink
+    // renders every frame itself
+    QueueHandle_t queue;
+};
+
+// Read the clock, marking the first sync in the boot profile and
+// logging the time. If frame isn't NULL the time of day is rendered in
+// to it as CLOCK_TASK_DIGITS digits.
+void clock_tick(Clock* clock, char* frame);
+
+// Body of the clock task. Calls clock_tick() once a second and sends
+// each frame to the display task. arg is a ClockTaskArgs.
+void task_clock(void* arg);
+
+// Render the frame for the second starting at us as HHMMSS. Given to
+// the colon blink, which calls it half a second early so the frame is
+// ready on the edge.
+void render_second(int64_t us, char* frame, void* arg);
+
+#endif // MAIN_CLOCK_TASK_H_
@@ -0,0 +1,314 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "http_api.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "boot_profile.hpp"
+#include "settings.hpp"
+
+// Stack size for the HTTP server task. Handlers only format into the
+// static buffers below so this can be kept small.
+#define HTTP_API_STACK_SIZE 3072
+
+// Size of the buffer each response is rendered in to
+#define HTTP_API_RESPONSE_SIZE 512
+
+// Largest request body that will be accepted
+#define HTTP_API_BODY_SIZE 96
+
+// All handlers run in the single HTTP server task, one at a time, so a
+// single set of static buffers can be shared between them. Nothing is
+// allocated per request.
+static char response[HTTP_API_RESPONSE_SIZE];
+static char body[HTTP_API_BODY_SIZE];
+
+static Clock* api_clock;
+static TM1637* api_display;
+static ColonBlink* api_blink;
+static DisplayAccuracy* api_accuracy;
+
+// Request statistics. Latency covers the time spent in the handler,
+// including sending the response.
+static struct {
+    uint32_t requests;
+    uint32_t errors;
+    int64_t last_latency_us;
+    int64_t max_latency_us;
+} stats;
+
+static const char TAG[] = "HTTP_API";
+
+// Record the latency of a request that started at start_us
+static void record_request(int64_t start_us, esp_err_t err) {
+    int64_t latency = esp_timer_get_time() - start_us;
+    stats.requests++;
+    if (err != ESP_OK) {
+        stats.errors++;
+    }
+    stats.last_latency_us = latency;
+    if (latency > stats.max_latency_us) {
+        stats.max_latency_us = latency;
+    }
+}
+
+// Send the contents of the response buffer as JSON. len is the return
+// value from snprintf.
+static esp_err_t send_json(httpd_req_t* req, int len) {
+    if (len < 0 || len >= (int)sizeof(response)) {
+        ESP_LOGE(TAG, "Response for %s truncated", req->uri);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, response, len);
+}
+
+// Read the request body in to the body buffer. Bodies are expected to
+// be form encoded, e.g. level=3
+static esp_err_t read_body(httpd_req_t* req) {
+    if (req->content_len == 0 || req->content_len >= sizeof(body)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid body");
+        return ESP_FAIL;
+    }
+
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(
+            req,
+            body + received,
+            req->content_len - received
+        );
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    body[received] = '\0';
+    return ESP_OK;
+}
+
+static esp_err_t handler_status(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+
+    int len = snprintf(
+        response, sizeof(response),
+        "{\"time\":%ld,\"uptime_s\":%" PRId64 ",\"synced\":%s,"
+        "\"free_heap\":%" PRIu32 ",\"min_free_heap\":%" PRIu32 ","
+        "\"http\":{\"requests\":%" PRIu32 ",\"errors\":%" PRIu32 ","
+        "\"last_latency_us\":%" PRId64 ",\"max_latency_us\":%" PRId64 "},"
+        "\"blink\":{\"last_error_us\":%" PRId64 ","
+        "\"max_error_us\":%" PRId64 ",\"mean_error_us\":%" PRId64 "},"
+        "\"display\":{\"bus_max_us_per_s\":%" PRId64 ","
+        "\"bus_mean_us_per_s\":%" PRId64 "}}",
+        (long)time(NULL),
+        start / 1000000,
+        api_clock->Synced() ? "true" : "false",
+        (uint32_t)esp_get_free_heap_size(),
+        (uint32_t)esp_get_minimum_free_heap_size(),
+        stats.requests,
+        stats.errors,
+        stats.last_latency_us,
+        stats.max_latency_us,
+        api_blink ? api_blink->LastErrorUs() : (int64_t)0,
+        api_blink ? api_blink->MaxErrorUs() : (int64_t)0,
+        api_blink ? api_blink->MeanErrorUs() : (int64_t)0,
+        api_display->BusMaxUs(),
+        api_display->BusMeanUs()
+    );
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_sync(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+    char server[Clock::kMaxServerLen + 1];
+    api_clock->Server(server);
+
+    int len = snprintf(
+        response, sizeof(response),
+        "{\"server\":\"%s\",\"synced\":%s,\"sync_count\":%d,"
+        "\"last_sync\":%ld,\"last_step_ms\":%" PRId64 "}",
+        server,
+        api_clock->Synced() ? "true" : "false",
+        api_clock->SyncCount(),
+        (long)api_clock->LastSync(),
+        api_clock->LastStepMs()
+    );
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_accuracy(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+
+    int len = snprintf(
+        response, sizeof(response),
+        "{\"frames\":%" PRIu32 ",\"early\":%" PRIu32 ","
+        "\"p50_us\":%" PRId64 ",\"p90_us\":%" PRId64 ","
+        "\"p99_us\":%" PRId64 ",\"max_us\":%" PRId64 "}",
+        api_accuracy->Count(),
+        api_accuracy->Early(),
+        api_accuracy->PercentileUs(50),
+        api_accuracy->PercentileUs(90),
+        api_accuracy->PercentileUs(99),
+        api_accuracy->MaxErrorUs()
+    );
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_boot(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+
+    int len = boot_profile_format(response, sizeof(response));
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_settings_get(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+
+    int len = snprintf(
+        response, sizeof(response),
+        "{\"ntp_server\":\"%s\"}",
+        get_ntp_server()
+    );
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_settings_post(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+    char server[Clock::kMaxServerLen + 1];
+
+    esp_err_t err = read_body(req);
+    if (err == ESP_OK) {
+        err = httpd_query_key_value(body, "ntp_server", server, sizeof(server));
+        if (err == ESP_OK) {
+            err = set_ntp_server(server);
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid server");
+        }
+        else {
+            api_clock->SetServer(get_ntp_server());
+            return handler_settings_get(req);
+        }
+    }
+
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_brightness_get(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+
+    int len = snprintf(
+        response, sizeof(response),
+        "{\"brightness\":%d}",
+        api_display->Brightness()
+    );
+
+    esp_err_t err = send_json(req, len);
+    record_request(start, err);
+    return err;
+}
+
+static esp_err_t handler_brightness_post(httpd_req_t* req) {
+    int64_t start = esp_timer_get_time();
+    char level[4];
+
+    esp_err_t err = read_body(req);
+    if (err == ESP_OK) {
+        err = httpd_query_key_value(body, "level", level, sizeof(level));
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid level");
+        }
+        else {
+            api_display->SetBrightness(atoi(level));
+            return handler_brightness_get(req);
+        }
+    }
+
+    record_request(start, err);
+    return err;
+}
+
+static const httpd_uri_t uri_handlers[] = {
+    {"/api/status", HTTP_GET, handler_status, NULL},
+    {"/api/sync", HTTP_GET, handler_sync, NULL},
+    {"/api/accuracy", HTTP_GET, handler_accuracy, NULL},
+    {"/api/boot", HTTP_GET, handler_boot, NULL},
+    {"/api/settings", HTTP_GET, handler_settings_get, NULL},
+    {"/api/settings", HTTP_POST, handler_settings_post, NULL},
+    {"/api/brightness", HTTP_GET, handler_brightness_get, NULL},
+    {"/api/brightness", HTTP_POST, handler_brightness_post, NULL},
+};
+
+esp_err_t http_api_start(
+    Clock* clock,
+    TM1637* display,
+    ColonBlink* blink,
+    DisplayAccuracy* accuracy
+) {
+    api_clock = clock;
+    api_display = display;
+    api_blink = blink;
+    api_accuracy = accuracy;
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_HTTP_API_PORT;
+    config.stack_size = HTTP_API_STACK_SIZE;
+    config.max_uri_handlers = sizeof(uri_handlers) / sizeof(uri_handlers[0]);
+
+    // Hard cap on concurrent connections. When the cap is reached the
+    // least recently used connection is closed to make room rather than
+    // letting new ones queue up and hold on to heap.
+    config.max_open_sockets = CONFIG_HTTP_API_MAX_CONNECTIONS;
+    config.backlog_conn = CONFIG_HTTP_API_MAX_CONNECTIONS;
+    config.lru_purge_enable = true;
+
+    ESP_LOGI(
+        TAG,
+        "Starting HTTP API on port %d. Max connections: %d",
+        config.server_port,
+        config.max_open_sockets
+    );
+
+    httpd_handle_t server = NULL;
+    esp_err_t err = httpd_start(&server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start HTTP server: %d", err);
+        return err;
+    }
+
+    for (size_t i = 0; i < sizeof(uri_handlers) / sizeof(uri_handlers[0]); i++) {
+        httpd_register_uri_handler(server, &uri_handlers[i]);
+    }
+
+    return ESP_OK;
+}
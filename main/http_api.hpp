@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MAIN_HTTP_API_H_
+#define MAIN_HTTP_API_H_
+
+#include "esp_err.h"
+
+#include "display/colon_blink.hpp"
+#include "display/tm1637.hpp"
+#include "timekeeping/accuracy.hpp"
+#include "timekeeping/clock.hpp"
+
+// Start the HTTP control and status API on the station interface.
+// The objects passed in must outlive the server. blink may be NULL if
+// the colon is not blinking.
+esp_err_t http_api_start(
+    Clock* clock,
+    TM1637* display,
+    ColonBlink* blink,
+    DisplayAccuracy* accuracy
+);
+
+#endif // MAIN_HTTP_API_H_
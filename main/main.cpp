@@ -9,36 +9,80 @@
 #include "freertos/queue.h"
 #include "sdkconfig.h"
 
+#include "boot_profile.hpp"
+#include "clock_task.hpp"
+#include "display/colon_blink.hpp"
 #include "display/tm1637.hpp"
+#include "http_api.hpp"
+#include "scheduler/event_loop.hpp"
+#include "settings.hpp"
+#include "timekeeping/accuracy.hpp"
 #include "timekeeping/clock.hpp"
+#include "timekeeping/ntp_server.hpp"
 #include "wifi_init.hpp"
 
 QueueHandle_t display_queue;
 
-void task_clock(void* arg) {
-    Clock clock(get_ntp_server());
-
-    // Some buffers for sending message to display
-    char msg[4];
-
-    for (;;) {
-        clock.Now();
-        msg[0] = (clock.Hour() / 10) % 10;
-        msg[1] = clock.Hour() % 10;
-        msg[2] = (clock.Minute() / 10) % 10;
-        msg[3] = clock.Minute() % 10;
-        xQueueSend(display_queue, msg, 0);
-        ESP_LOGI(
-            "TIME", "%d:%d:%d",
-            clock.Hour(), clock.Minute(), clock.Second()
-        );
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-    }
+// Passed to the clock task
+ClockTaskArgs clock_args;
+
+// Tracks how far the display lags behind true time
+DisplayAccuracy accuracy;
+
+// Called each time a frame reaches the display
+void on_display_commit(const char* frame, int len, void* arg) {
+    accuracy.Record(frame, len, Clock::NowUs());
+    boot_profile_mark(BOOT_PHASE_FIRST_FRAME);
+}
+
+// How many times to try starting the HTTP API and how long to wait
+// between attempts
+#define HTTP_API_START_ATTEMPTS 10
+#define HTTP_API_RETRY_MS 1000
+
+// Number of digits on the display
+#ifdef CONFIG_DISPLAY_SECONDS
+#define DISPLAY_DIGITS 6
+#else
+#define DISPLAY_DIGITS 4
+#endif
+
+#ifdef CONFIG_RUNTIME_EVENT_LOOP
+// When running on the event loop the clock and display are driven
+// directly from timer callbacks instead of from their own tasks
+EventLoop event_loop;
+Clock* loop_clock;
+TM1637* loop_display;
+
+// Render the current time and write it straight to the display
+void on_clock_tick(void* arg) {
+#ifdef CONFIG_DISPLAY_SECONDS
+    // With seconds shown the colon blink writes each frame instead
+    clock_tick(loop_clock, NULL);
+#else
+    char msg[DISPLAY_DIGITS];
+    clock_tick(loop_clock, msg);
+    loop_display->Write(msg);
+#endif
+}
+
+// Periodically log resource usage
+void on_telemetry(void* arg) {
+    ESP_LOGI(
+        "TELEMETRY", "Free heap: %u. Minimum free heap: %u. Stack left: %u",
+        esp_get_free_heap_size(),
+        esp_get_minimum_free_heap_size(),
+        uxTaskGetStackHighWaterMark(NULL)
+    );
 }
 
+Timer clock_timer(on_clock_tick, NULL);
+Timer telemetry_timer(on_telemetry, NULL);
+#endif
+
 void task_display(void* arg) {
-    TM1637 disp(0, 2);
-    disp.WaitForMsg(&display_queue);
+    TM1637* disp = (TM1637*)arg;
+    disp->WaitForMsg(&display_queue);
 }
 
 // Output system information to the logging interface
@@ -96,12 +140,81 @@ void show_startup_info() {
 }
 
 extern "C" void app_main() {
+    boot_profile_mark(BOOT_PHASE_APP_MAIN);
     vTaskDelay(CONFIG_STARTUP_DELAY / portTICK_PERIOD_MS);
+    boot_profile_mark(BOOT_PHASE_STARTUP_DELAY);
     show_startup_info();
+    boot_profile_mark(BOOT_PHASE_STARTUP_INFO);
     network_init();
 
-    display_queue = xQueueCreate(10, sizeof(char[5]));
+    // These live for the lifetime of the device and are shared between
+    // the tasks and the HTTP API
+    Clock* clock = new Clock(get_ntp_server());
+    TM1637* disp = new TM1637(0, 2, DISPLAY_DIGITS);
+    ColonBlink* blink = NULL;
+
+    disp->SetOnCommit(on_display_commit, NULL);
+
+#ifdef CONFIG_COLON_BLINK
+    blink = new ColonBlink(disp, Clock::NowUs);
+#ifdef CONFIG_DISPLAY_SECONDS
+    blink->SetRender(render_second, NULL);
+#endif
+#ifdef CONFIG_RUNTIME_EVENT_LOOP
+    // Save a task by blinking from the loop everything else runs on
+    blink->Start(&event_loop);
+#else
+    blink->Start();
+#endif
+#endif
 
-    xTaskCreate(task_clock, "clock", 2048, NULL, 10, NULL);
-    xTaskCreate(task_display, "display", 2048, NULL, 10, NULL);
+#ifdef CONFIG_RUNTIME_EVENT_LOOP
+    loop_clock = clock;
+    loop_display = disp;
+    event_loop.Schedule(&clock_timer, 0, 1000);
+    event_loop.Schedule(
+        &telemetry_timer,
+        CONFIG_TELEMETRY_INTERVAL * 1000,
+        CONFIG_TELEMETRY_INTERVAL * 1000
+    );
+    event_loop.Start("event_loop", 2048, 10);
+#else
+#ifndef CONFIG_DISPLAY_SECONDS
+    // The clock task sends to the queue as soon as it runs so it has to
+    // exist first
+    display_queue = xQueueCreate(10, sizeof(char[DISPLAY_DIGITS]));
+    xTaskCreate(task_display, "display", 2048, disp, 10, NULL);
+#endif
+    clock_args.clock = clock;
+#ifdef CONFIG_DISPLAY_SECONDS
+    clock_args.queue = NULL;
+#else
+    clock_args.queue = display_queue;
+#endif
+    xTaskCreate(task_clock, "clock", 2048, &clock_args, 10, NULL);
+#endif
+
+#ifdef CONFIG_SNTP_SERVER_ENABLE
+    NtpServer* ntp_server = new NtpServer(
+        clock,
+        CONFIG_SNTP_SERVER_UPSTREAM_STRATUM,
+        CONFIG_SNTP_SERVER_ROOT_DELAY,
+        CONFIG_SNTP_SERVER_BASE_DISPERSION,
+        CONFIG_SNTP_SERVER_MAX_AGE
+    );
+    ntp_server->Start();
+#endif
+
+#ifdef CONFIG_HTTP_API_ENABLE
+    // Retry in case something else still has the port, rather than
+    // leaving the API down until the next reboot
+    for (int i = 1; http_api_start(clock, disp, blink, &accuracy) != ESP_OK;
+         i++) {
+        if (i == HTTP_API_START_ATTEMPTS) {
+            ESP_LOGE("HTTP_API", "Giving up starting the HTTP API");
+            break;
+        }
+        vTaskDelay(HTTP_API_RETRY_MS / portTICK_PERIOD_MS);
+    }
+#endif
 }
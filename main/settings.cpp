@@ -0,0 +1,81 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "settings.hpp"
+
+#include <cstring>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "timekeeping/clock.hpp"
+
+// NVS namespace and keys used for clock settings
+#define NVS_NAMESPACE "clock"
+#define NVS_KEY_NTP_SERVER "ntp_server"
+
+static const char TAG[] = "NVS";
+
+// Currently configured NTP server. Empty until first read from NVS
+static char ntp_server[Clock::kMaxServerLen + 1] = "";
+
+const char* get_ntp_server() {
+    // The server can be overridden at runtime and is stored in NVS.
+    // If nothing has been stored we fall back to the server set in the
+    // project configuration, or Clock's default if that isn't valid.
+    if (ntp_server[0] != '\0') {
+        return ntp_server;
+    }
+
+    nvs_handle handle;
+    size_t len = sizeof(ntp_server);
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        if (nvs_get_str(handle, NVS_KEY_NTP_SERVER, ntp_server, &len)
+            != ESP_OK) {
+            ntp_server[0] = '\0';
+        }
+        nvs_close(handle);
+    }
+
+    // Stored by an older version that didn't check what it was given
+    if (ntp_server[0] != '\0' && !Clock::IsValidServer(ntp_server)) {
+        ESP_LOGW(TAG, "Ignoring invalid stored NTP server");
+        ntp_server[0] = '\0';
+    }
+
+    if (ntp_server[0] == '\0') {
+        const char* fallback = CONFIG_NTP_SERVER;
+        if (!Clock::IsValidServer(fallback)) {
+            ESP_LOGE(TAG, "Invalid CONFIG_NTP_SERVER %s", fallback);
+            fallback = Clock::kDefaultServer;
+        }
+        strcpy(ntp_server, fallback);
+    }
+    return ntp_server;
+}
+
+esp_err_t set_ntp_server(const char* server) {
+    if (!Clock::IsValidServer(server)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_str(handle, NVS_KEY_NTP_SERVER, server);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store NTP server: %d", err);
+        return err;
+    }
+
+    strcpy(ntp_server, server);
+    ESP_LOGI(TAG, "NTP server set to %s", ntp_server);
+    return ESP_OK;
+}
@@ -0,0 +1,17 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MAIN_SETTINGS_H_
+#define MAIN_SETTINGS_H_
+
+#include "esp_err.h"
+
+// Get the currently configured NTP server
+const char* get_ntp_server();
+
+// Set the NTP server and store it in NVS so it persists across reboots.
+// Anything that isn't a valid host name is rejected with
+// ESP_ERR_INVALID_ARG.
+esp_err_t set_ntp_server(const char* server);
+
+#endif // MAIN_SETTINGS_H_
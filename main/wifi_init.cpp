@@ -12,7 +12,6 @@
 #include "freertos/event_groups.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "mdns.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "sdkconfig.h"
@@ -20,9 +19,20 @@
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_softap.h"
 
+#include "boot_profile.hpp"
+#include "mdns_responder/mdns_responder.hpp"
+
 const int WIFI_CONNECTED_EVENT = BIT0;
+
+// Set once the provisioning manager, and the HTTP server it runs on
+// port 80, has gone. Set straight away if we were already provisioned.
+const int WIFI_PROV_DONE_EVENT = BIT1;
 EventGroupHandle_t wifi_event_group;
 
+// mDNS responder. Records are fixed so it lives for the whole program
+MdnsResponder mdns_responder(CONFIG_MDNS_HOSTNAME, CONFIG_MDNS_INTANCE_NAME);
+bool mdns_started = false;
+
 void wifi_init_station() {
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_start())
@@ -84,8 +94,16 @@ void event_handler_wifi_prov(
         ESP_LOGI(TAG, "Provisioning successful");
         break;
     case WIFI_PROV_END:
+        // Tear down the softAP, protocomm and HTTP server and stop
+        // listening for events we will never see again
         ESP_LOGD(TAG, "Deinitialising provisioning manager");
         wifi_prov_mgr_deinit();
+        esp_event_handler_unregister(
+            WIFI_PROV_EVENT,
+            ESP_EVENT_ANY_ID,
+            &event_handler_wifi_prov
+        );
+        xEventGroupSetBits(wifi_event_group, WIFI_PROV_DONE_EVENT);
         break;
     default:
         ESP_LOGD(TAG, "Got unrecognised event. ID: %d", id);
@@ -140,6 +158,11 @@ void event_handler_ip(void* arg,
             IP2STR(&event->ip_info.gw)
         );
 
+        // Our address may have changed since we last announced it
+        if (mdns_started) {
+            mdns_responder.Announce();
+        }
+
         // Tell the rest of the program to continue
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_EVENT);
     }
@@ -151,14 +174,6 @@ void wifi_init_events() {
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     wifi_event_group = xEventGroupCreate();
 
-    ESP_ERROR_CHECK(
-        esp_event_handler_register(
-        WIFI_PROV_EVENT,
-        ESP_EVENT_ANY_ID,
-        &event_handler_wifi_prov,
-        NULL
-    ));
-
     ESP_ERROR_CHECK(
         esp_event_handler_register(
         WIFI_EVENT,
@@ -184,20 +199,53 @@ void wifi_init_net() {
 }
 
 void wifi_init_mdns() {
-    esp_err_t err = mdns_init();
-    if (err) {
-        ESP_LOGE("MDNS", "Failed to init MDNS: %d", err);
-    }
-    else {
-        mdns_hostname_set(CONFIG_MDNS_HOSTNAME);
-        mdns_instance_name_set(CONFIG_MDNS_INTANCE_NAME);
-    }
+#ifdef CONFIG_HTTP_API_ENABLE
+    mdns_responder.AddService(
+        "_http", "_tcp",
+        CONFIG_HTTP_API_PORT,
+        "path=/api"
+    );
+#endif
+#ifdef CONFIG_SNTP_SERVER_ENABLE
+    // Let other clocks find us
+    mdns_responder.AddService("_ntp", "_udp", 123);
+#endif
+    mdns_responder.Start();
+    mdns_started = true;
+}
 
+bool wifi_is_provisioned() {
+    // This is the same check the provisioning manager does, but
+    // without having to bring the manager up first
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK) {
+        return false;
+    }
+    return config.sta.ssid[0] != '\0';
 }
 
 void wifi_init_provisioning() {
     const char TAG[] = "WIFI_PROVISIONING";
 
+    if (wifi_is_provisioned()) {
+        ESP_LOGI(TAG, "Device already provisioned. Starting station");
+        xEventGroupSetBits(wifi_event_group, WIFI_PROV_DONE_EVENT);
+        wifi_init_station();
+        return;
+    }
+
+    ESP_LOGI(TAG, "Starting provisioning service");
+
+    // Only listen for provisioning events while provisioning. The
+    // handler removes itself once provisioning has finished.
+    ESP_ERROR_CHECK(
+        esp_event_handler_register(
+        WIFI_PROV_EVENT,
+        ESP_EVENT_ANY_ID,
+        &event_handler_wifi_prov,
+        NULL
+    ));
+
     wifi_prov_mgr_config_t config = {
         .scheme = wifi_prov_scheme_softap,
         .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE,
@@ -206,28 +254,16 @@ void wifi_init_provisioning() {
 
     ESP_ERROR_CHECK(wifi_prov_mgr_init(config));
 
-    bool provisioned = false;
-
-    ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
-
-    if (!provisioned) {
-        ESP_LOGI(TAG, "Starting provisioning service");
-        // Last 6 characters of MAC + teminator
-        char ssid[sizeof(CONFIG_SOFTAP_SSID_PREFIX) + 6 * sizeof(char) + 1];
-        wifi_get_ssid(ssid, sizeof(ssid));
+    // Last 6 characters of MAC + teminator
+    char ssid[sizeof(CONFIG_SOFTAP_SSID_PREFIX) + 6 * sizeof(char) + 1];
+    wifi_get_ssid(ssid, sizeof(ssid));
 
-        // Set security level
-        // Level 1 with no proof of posession
-        wifi_prov_security_t sec_level = WIFI_PROV_SECURITY_1;
-        ESP_ERROR_CHECK(
-            wifi_prov_mgr_start_provisioning(sec_level, NULL, ssid, NULL)
-        );
-    }
-    else {
-        ESP_LOGI(TAG, "Device already provisioned. Starting station");
-        wifi_prov_mgr_deinit();
-        wifi_init_station();
-    }
+    // Set security level
+    // Level 1 with no proof of posession
+    wifi_prov_security_t sec_level = WIFI_PROV_SECURITY_1;
+    ESP_ERROR_CHECK(
+        wifi_prov_mgr_start_provisioning(sec_level, NULL, ssid, NULL)
+    );
 }
 
 void init_non_volatile_storage() {
@@ -252,27 +288,27 @@ void network_init() {
     ESP_LOGI(TAG, "Starting network configuration");
 
     init_non_volatile_storage();
+    boot_profile_mark(BOOT_PHASE_NVS);
     wifi_init_events();  // Initialize event handlers
+    boot_profile_mark(BOOT_PHASE_EVENTS);
     wifi_init_net();  // Initialize networking
-    wifi_init_mdns();  // Initialize mDNS
+    boot_profile_mark(BOOT_PHASE_WIFI);
     wifi_init_provisioning();  // Initialize and start provisioning as required
+    boot_profile_mark(BOOT_PHASE_PROVISIONING);
 
-    // Wait for connection
+    // Wait for connection. When we have just been provisioned, also wait
+    // for the provisioning manager to go, so its HTTP server isn't still
+    // holding the port the API wants.
     xEventGroupWaitBits(
         wifi_event_group,
-        WIFI_CONNECTED_EVENT,
+        WIFI_CONNECTED_EVENT | WIFI_PROV_DONE_EVENT,
         true,
         true,
         portMAX_DELAY
     );
+    boot_profile_mark(BOOT_PHASE_CONNECTED);
+    wifi_init_mdns();  // Start answering mDNS queries now we have an IP
+    boot_profile_mark(BOOT_PHASE_MDNS);
 
     ESP_LOGI(TAG, "Finished network configuration");
 }
-
-const char* get_ntp_server() {
-    // Currently, ntp server is retrieved by DHCP so we just use
-    // preprocessor deffinitions. This should be updated in the future
-    // to get NTP server from DHCP or alike.
-
-    return CONFIG_NTP_SERVER;
-}
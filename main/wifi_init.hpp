@@ -44,19 +44,22 @@ void wifi_init_events();
 // Initialise TCP/IP and WiFi interface
 void wifi_init_net();
 
-// Initialise the mDNS service
+// Start the mDNS responder. Must be called once we have an IP address
 void wifi_init_mdns();
 
-// Initialise provisioning and check if we actually need to do anything
+// Check if station credentials have been stored
+bool wifi_is_provisioned();
+
+// Start the station if we have credentials, otherwise bring up the
+// provisioning manager. The manager is torn down once provisioning has
+// finished.
 void wifi_init_provisioning();
 
 // Init the default NVS partition for key value storage
 void init_non_volatile_storage();
 
-// Provision this device
+// Provision this device. Returns once connected and, if provisioning
+// was needed, once the provisioning manager has been torn down.
 void network_init();
 
-// Get the currently configured NTP server
-const char* get_ntp_server();
-
 #endif // MAIN_WIFI_INIT_H_
@@ -0,0 +1,316 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// End to end accuracy of the displayed time.
+//
+// Runs the clock and display as the firmware does, with SNTP polling a
+// simulated NTP server over a network with latency, jitter, asymmetry
+// and loss, and a server that can be stepped. The display's pins are
+// decoded by an emulated TM1637 and every frame it shows is recorded by
+// DisplayAccuracy against true time, so the error includes SNTP as
+// well as rendering, scheduling and the bus. The same frames are also
+// recorded against the device's own clock, as /api/accuracy does, to
+// show how much of the error that can't see.
+//
+// Each scenario runs twice, once showing hours and minutes from the
+// firmware's clock task and once showing seconds from the colon blink
+// with the firmware's render function. The wall
+// clock is also checked every second against what the server told it,
+// allowing for the network and the crystal's drift since.
+//
+//   accuracy_harness [hours] [seed]
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "accuracy.hpp"
+#include "clock.hpp"
+#include "clock_task.hpp"
+#include "colon_blink.hpp"
+#include "display_bus.hpp"
+#include "tm1637.hpp"
+#include "fakes/ntp.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/tm1637_decoder.hpp"
+#include "fakes/wall_clock.hpp"
+#include "test.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define SECOND_US 1000000LL
+#define HOUR_US (3600 * SECOND_US)
+
+// 2026-01-01 00:00:00 UTC, part way through a second so nothing starts
+// in phase with true time
+#define START_US (1767225600LL * SECOND_US + 345678)
+
+// Drift of the device's crystal
+#define DRIFT_PPM 10
+
+// RTOS tick that esp_timers run from
+#define TICK_US 10000
+
+// Time after the first sync before frames are recorded, so frames
+// rendered from the unset clock have been replaced
+#define SETTLE_US (2 * SECOND_US)
+
+// Slack in the wall clock check for rounding
+#define MARGIN_US 1000
+
+// Only report the first few failures of each run
+#define MAX_REPORTS 5
+
+struct Scenario {
+    const char* name;
+    int64_t latency_us;
+    int64_t jitter_us;
+    int64_t asymmetry_us;
+    int loss_percent;
+    bool compensate;
+
+    // The server's clock is stepped by this a third of the way through
+    // and back again two thirds of the way
+    int64_t step_us;
+
+    // Largest delay to the display bus interrupt, as WiFi causes
+    int bus_jitter_us;
+};
+
+static const Scenario scenarios[] = {
+    {"lan", 500, 200, 0, 0, false, 0, 0},
+    {"wifi", 3000, 20000, 0, 2, false, 0, 40},
+    {"asymmetric", 5000, 2000, 40000, 0, false, 0, 0},
+    {"compensated", 5000, 2000, 40000, 0, true, 0, 0},
+    {"lossy", 20000, 50000, 10000, 30, false, 0, 40},
+    {"step", 3000, 2000, 0, 0, false, 1500000, 0},
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct Run {
+    const Scenario* scenario;
+    int digits;
+    Clock* clock;
+    TM1637* display;
+    QueueHandle_t queue;
+    ClockTaskArgs clock_task;
+
+    // Displayed time against true time, and against the device's clock
+    DisplayAccuracy truth;
+    DisplayAccuracy device;
+    bool recording;
+
+    // Wall clock error from true time, sampled every second
+    std::vector<int64_t> clock_error;
+    int64_t last_sample;
+    int64_t first_sync;
+    int64_t last_sync;
+    int syncs;
+    int out_of_bounds;
+};
+
+// Frames decoded from the display's pins
+static void on_update(Tm1637Decoder* decoder, void* arg) {
+    Run* r = (Run*)arg;
+    if (!r->recording) {
+        return;
+    }
+    char digits[TM1637::kMaxDigits];
+    for (int i = 0; i < r->digits; i++) {
+        int digit = decoder->Digit(i);
+        if (digit < 0) {
+            return;
+        }
+        digits[i] = digit;
+    }
+    r->truth.Record(digits, r->digits, sim_true_us());
+}
+
+// What main.cpp records for /api/accuracy
+static void on_commit(const char* frame, int len, void* arg) {
+    Run* r = (Run*)arg;
+    r->device.Record(frame, len, Clock::NowUs());
+}
+
+static void task_display(void* arg) {
+    Run* r = (Run*)arg;
+    r->display->WaitForMsg(&r->queue);
+}
+
+// Check the wall clock against the server every second
+static void sample(void* arg) {
+    Run* r = (Run*)arg;
+    int64_t now = sim_now_us();
+    sim_schedule(now + SECOND_US, sample, r);
+
+    SimNtpStats stats = sim_ntp_stats();
+    if (stats.syncs == 0) {
+        r->last_sample = now;
+        return;
+    }
+    if (stats.syncs != r->syncs) {
+        // Synced some time since the last sample
+        if (r->syncs == 0) {
+            r->first_sync = now;
+        }
+        r->syncs = stats.syncs;
+        r->last_sync = r->last_sample;
+    }
+    r->last_sample = now;
+    r->recording = now >= r->first_sync + SETTLE_US;
+
+    int64_t error = sim_wall_us() - sim_true_us();
+    r->clock_error.push_back(error);
+
+    // Set within a packet's delay of the server, then drifting
+    const Scenario* s = r->scenario;
+    int64_t bound = s->latency_us + s->jitter_us + llabs(s->asymmetry_us)
+        + DRIFT_PPM * (now - r->last_sync) / 1000000 + MARGIN_US;
+    int64_t wrong = llabs(error - stats.server_offset_us);
+    if (wrong > bound && r->out_of_bounds++ < MAX_REPORTS) {
+        printf(
+            "%s: clock %lld us from the server at %lld s, allowed %lld\n",
+            s->name,
+            (long long)wrong,
+            (long long)(now / SECOND_US),
+            (long long)bound
+        );
+    }
+}
+
+static void step_forward(void* arg) {
+    sim_ntp_server_step(((Run*)arg)->scenario->step_us);
+}
+
+static void step_back(void* arg) {
+    sim_ntp_server_step(-((Run*)arg)->scenario->step_us);
+}
+
+static void run(const Scenario* s, bool seconds, int64_t duration,
+                uint64_t seed) {
+    sim_reset();
+    sim_esp_timer_tick(TICK_US);
+    sim_hw_timer_jitter(s->bus_jitter_us, seed);
+    sim_wall_drift(DRIFT_PPM);
+
+    SimNtpNetwork network;
+    network.start_us = START_US;
+    network.latency_us = s->latency_us;
+    network.jitter_us = s->jitter_us;
+    network.asymmetry_us = s->asymmetry_us;
+    network.loss_percent = s->loss_percent;
+    network.compensate = s->compensate;
+    network.seed = seed;
+    sim_ntp_network(&network);
+
+    // Never freed, as the tasks are left blocked when the simulation is
+    // reset
+    Run* r = new Run();
+    r->scenario = s;
+    r->digits = seconds ? 6 : 4;
+
+    DisplayBus bus;
+    TM1637 disp(0, 2, r->digits, &bus);
+    Tm1637Decoder decoder(0, 2);
+    decoder.SetOnUpdate(on_update, r);
+    disp.SetOnCommit(on_commit, r);
+
+    Clock clock("pool.ntp.org");
+    r->clock = &clock;
+    r->display = &disp;
+    ColonBlink blink(&disp, Clock::NowUs);
+    if (seconds) {
+        blink.SetRender(render_second, NULL);
+        blink.Start();
+    }
+    else {
+        r->queue = xQueueCreate(10, sizeof(char[CLOCK_TASK_DIGITS]));
+        r->clock_task.clock = &clock;
+        r->clock_task.queue = r->queue;
+        xTaskCreate(task_display, "display", 2048, r, 10, NULL);
+        xTaskCreate(task_clock, "clock", 2048, &r->clock_task, 10, NULL);
+    }
+
+    sim_schedule(SECOND_US, sample, r);
+    if (s->step_us != 0) {
+        sim_schedule(duration / 3, step_forward, r);
+        sim_schedule(duration * 2 / 3, step_back, r);
+    }
+    sim_run_until(duration);
+
+    std::vector<int64_t>& errors = r->clock_error;
+    for (int64_t& e : errors) {
+        e = llabs(e);
+    }
+    std::sort(errors.begin(), errors.end());
+    size_t n = errors.size();
+    CHECK(n > 0);
+    if (n == 0) {
+        return;
+    }
+    int64_t max_clock_error = errors[n - 1];
+
+    printf(
+        "%-11s %-7s %7lld %7lld %7lld %5lld %5lld %5lld %5lld %6u %5lld\n",
+        s->name,
+        seconds ? "HHMMSS" : "HHMM",
+        (long long)errors[n / 2],
+        (long long)errors[n * 99 / 100],
+        (long long)max_clock_error,
+        (long long)(r->truth.PercentileUs(50) / 1000),
+        (long long)(r->truth.PercentileUs(90) / 1000),
+        (long long)(r->truth.PercentileUs(99) / 1000),
+        (long long)(r->truth.MaxErrorUs() / 1000),
+        r->truth.Early(),
+        (long long)(r->device.PercentileUs(99) / 1000)
+    );
+
+    // SNTP kept the clock where the server put it and polled hourly
+    SimNtpStats stats = sim_ntp_stats();
+    CHECK_EQ(r->out_of_bounds, 0);
+    CHECK(stats.syncs >= duration / HOUR_US);
+
+    // Every change of what is shown was seen, none of them further out
+    // than the clock was plus what the display adds. Hours and minutes
+    // can be shown up to a second late, as the clock task runs once a
+    // second.
+    int64_t recorded = duration - r->first_sync - SETTLE_US;
+    int64_t changes = seconds
+        ? recorded / SECOND_US
+        : recorded / (60 * SECOND_US);
+    int64_t lag = seconds ? 50000 : SECOND_US + 50000;
+    CHECK(r->truth.Count() >= changes * 9 / 10);
+    CHECK(r->truth.MaxErrorUs() <= max_clock_error + lag);
+    CHECK_EQ(decoder.Errors(), 0);
+}
+
+int main(int argc, char** argv) {
+    int hours = (argc > 1) ? atoi(argv[1]) : 2;
+    uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1;
+    int64_t duration = hours * HOUR_US;
+
+    printf(
+        "%d hours per run, drift %d ppm. Clock error from true time in "
+        "us, sampled each\nsecond. Display error from true time in ms, "
+        "to the 50 ms buckets of\nDisplayAccuracy, and the p99 "
+        "/api/accuracy would report.\n\n",
+        hours,
+        DRIFT_PPM
+    );
+    printf(
+        "%-11s %-7s %7s %7s %7s %5s %5s %5s %5s %6s %5s\n",
+        "scenario", "shows", "p50", "p99", "max",
+        "p50", "p90", "p99", "max", "early", "api"
+    );
+    for (size_t i = 0; i < NUM_SCENARIOS; i++) {
+        run(&scenarios[i], false, duration, seed);
+        run(&scenarios[i], true, duration, seed);
+    }
+
+    return test_result("accuracy_harness");
+}
@@ -0,0 +1,180 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "httpd.hpp"
+
+#include <string.h>
+
+#define MAX_HANDLERS 16
+
+static httpd_config_t config;
+static httpd_uri_t handlers[MAX_HANDLERS];
+static int num_handlers = 0;
+
+// State of the request being handled
+struct FakeRequest {
+    const char* body;
+    size_t pos;
+    size_t chunk;
+    bool timed_out;
+    SimHttpResponse* response;
+};
+
+httpd_config_t httpd_default_config() {
+    httpd_config_t c;
+    c.task_priority = 5;
+    c.stack_size = 4096;
+    c.server_port = 80;
+    c.max_open_sockets = 7;
+    c.max_uri_handlers = 8;
+    c.backlog_conn = 5;
+    c.lru_purge_enable = false;
+    return c;
+}
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* c) {
+    config = *c;
+    num_handlers = 0;
+    *handle = &config;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(
+    httpd_handle_t handle,
+    const httpd_uri_t* uri
+) {
+    if (num_handlers >= MAX_HANDLERS || num_handlers >= config.max_uri_handlers) {
+        return ESP_ERR_NO_MEM;
+    }
+    handlers[num_handlers++] = *uri;
+    return ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t len) {
+    FakeRequest* r = (FakeRequest*)req->aux;
+
+    // Time out once before each piece, as a slow client would
+    if (!r->timed_out) {
+        r->timed_out = true;
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+    r->timed_out = false;
+
+    size_t left = req->content_len - r->pos;
+    if (len > left) {
+        len = left;
+    }
+    if (len > r->chunk) {
+        len = r->chunk;
+    }
+    memcpy(buf, r->body + r->pos, len);
+    r->pos += len;
+    return len;
+}
+
+esp_err_t httpd_query_key_value(
+    const char* query,
+    const char* key,
+    char* value,
+    size_t len
+) {
+    size_t key_len = strlen(key);
+    const char* p = query;
+    while (*p != '\0') {
+        const char* end = strchr(p, '&');
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char* v = p + key_len + 1;
+            size_t v_len = end - v;
+            if (len == 0) {
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+            }
+            size_t copy = (v_len < len - 1) ? v_len : len - 1;
+            memcpy(value, v, copy);
+            value[copy] = '\0';
+            return (copy < v_len) ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+        }
+        p = (*end == '&') ? end + 1 : end;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type) {
+    FakeRequest* r = (FakeRequest*)req->aux;
+    strncpy(r->response->type, type, sizeof(r->response->type) - 1);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len) {
+    FakeRequest* r = (FakeRequest*)req->aux;
+    if (len < 0) {
+        len = strlen(buf);
+    }
+    if (len >= (ssize_t)sizeof(r->response->body)) {
+        return ESP_FAIL;
+    }
+    memcpy(r->response->body, buf, len);
+    r->response->body[len] = '\0';
+    r->response->len = len;
+    r->response->status = 200;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(
+    httpd_req_t* req,
+    httpd_err_code_t error,
+    const char* message
+) {
+    FakeRequest* r = (FakeRequest*)req->aux;
+    switch (error) {
+    case HTTPD_400_BAD_REQUEST:
+        r->response->status = 400;
+        break;
+    case HTTPD_404_NOT_FOUND:
+        r->response->status = 404;
+        break;
+    default:
+        r->response->status = 500;
+        break;
+    }
+    r->response->body[0] = '\0';
+    r->response->len = 0;
+    return ESP_OK;
+}
+
+bool sim_http_request(
+    httpd_method_t method,
+    const char* uri,
+    const char* body,
+    size_t chunk,
+    SimHttpResponse* response
+) {
+    for (int i = 0; i < num_handlers; i++) {
+        if (handlers[i].method != method || strcmp(handlers[i].uri, uri) != 0) {
+            continue;
+        }
+
+        FakeRequest r = {body, 0, chunk, false, response};
+        httpd_req_t req;
+        req.handle = &config;
+        req.method = method;
+        req.uri = uri;
+        req.content_len = (body == NULL) ? 0 : strlen(body);
+        req.user_ctx = handlers[i].user_ctx;
+        req.aux = &r;
+
+        response->status = 0;
+        response->type[0] = '\0';
+        response->len = 0;
+        response->body[0] = '\0';
+        handlers[i].handler(&req);
+        return true;
+    }
+    return false;
+}
+
+const httpd_config_t* sim_http_config() {
+    return &config;
+}
@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_HTTPD_H_
+#define FAKES_HTTPD_H_
+
+#include <stddef.h>
+
+#include "esp_http_server.h"
+
+// Emulated HTTP server. Handlers registered with httpd_register_uri_handler()
+// are called directly by sim_http_request(), one request at a time as
+// the real server does. Nothing is allocated per request.
+
+// What a handler sent back
+struct SimHttpResponse {
+    // 200 for httpd_resp_send(), otherwise the error status
+    int status;
+    char type[32];
+    char body[1024];
+    int len;
+};
+
+// Make a request. The body is handed to the handler in pieces of at most
+// chunk bytes, with a timeout before each, to exercise partial reads.
+// Returns false if there is no handler for the method and URI.
+bool sim_http_request(
+    httpd_method_t method,
+    const char* uri,
+    const char* body,
+    size_t chunk,
+    SimHttpResponse* response
+);
+
+// Configuration the server was started with
+const httpd_config_t* sim_http_config();
+
+#endif  // FAKES_HTTPD_H_
@@ -0,0 +1,235 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "lwip.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "lwip/igmp.h"
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+#include "sim.hpp"
+
+#define MAX_PCBS 4
+
+struct udp_pcb {
+    bool used;
+    uint16_t port;
+    udp_recv_fn recv;
+    void* arg;
+};
+
+// A datagram waiting for the TCP/IP task
+struct Delivery {
+    struct udp_pcb* pcb;
+    struct pbuf* p;
+    ip_addr_t from;
+    uint16_t port;
+};
+
+struct Timeout {
+    sys_timeout_handler handler;
+    void* arg;
+    bool cancelled;
+};
+
+const ip_addr_t ip_addr_any = {};
+
+static struct netif netif;
+struct netif* netif_default = &netif;
+
+static struct udp_pcb pcbs[MAX_PCBS];
+static SimUdpListener listener = NULL;
+static void* listener_arg = NULL;
+static int igmp_groups = 0;
+
+// Timeouts that haven't run yet, in the order they were set
+static std::vector<Timeout*> timeouts;
+
+void sim_lwip_reset() {
+    memset(&netif, 0, sizeof(netif));
+    memset(pcbs, 0, sizeof(pcbs));
+    listener = NULL;
+    listener_arg = NULL;
+    igmp_groups = 0;
+
+    // Their events are dropped with the rest of the simulation
+    timeouts.clear();
+}
+
+void sim_udp_listen(SimUdpListener fn, void* arg) {
+    listener = fn;
+    listener_arg = arg;
+}
+
+static void receive(void* arg) {
+    Delivery* d = (Delivery*)arg;
+    if (d->pcb->used && d->pcb->recv != NULL) {
+        d->pcb->recv(d->pcb->arg, d->pcb, d->p, &d->from, d->port);
+    }
+    else {
+        pbuf_free(d->p);
+    }
+    delete d;
+}
+
+void sim_udp_deliver(
+    uint16_t port,
+    const uint8_t* data,
+    int len,
+    const ip_addr_t* from,
+    uint16_t from_port
+) {
+    for (int i = 0; i < MAX_PCBS; i++) {
+        if (pcbs[i].used && pcbs[i].port == port) {
+            Delivery* d = new Delivery();
+            d->pcb = &pcbs[i];
+            d->p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+            pbuf_take(d->p, data, len);
+            d->from = *from;
+            d->port = from_port;
+            tcpip_callback(receive, d);
+            return;
+        }
+    }
+}
+
+void sim_netif_set_ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    IP_ADDR4(&netif.ip_addr, a, b, c, d);
+}
+
+int sim_igmp_groups() {
+    return igmp_groups;
+}
+
+struct netif* ip_current_netif() {
+    return &netif;
+}
+
+err_t igmp_joingroup(const ip4_addr_t* if_addr, const ip4_addr_t* group) {
+    igmp_groups++;
+    return ERR_OK;
+}
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, uint16_t len, pbuf_type type) {
+    struct pbuf* p = (struct pbuf*)malloc(sizeof(struct pbuf) + len);
+    if (p == NULL) {
+        return NULL;
+    }
+    p->next = NULL;
+    p->payload = p + 1;
+    p->tot_len = len;
+    p->len = len;
+    return p;
+}
+
+uint8_t pbuf_free(struct pbuf* p) {
+    free(p);
+    return 1;
+}
+
+err_t pbuf_take(struct pbuf* p, const void* data, uint16_t len) {
+    if (len > p->len) {
+        return ERR_MEM;
+    }
+    memcpy(p->payload, data, len);
+    return ERR_OK;
+}
+
+// Only ever shrinks, as in lwIP
+void pbuf_realloc(struct pbuf* p, uint16_t size) {
+    if (size < p->len) {
+        p->len = size;
+        p->tot_len = size;
+    }
+}
+
+struct udp_pcb* udp_new() {
+    for (int i = 0; i < MAX_PCBS; i++) {
+        if (!pcbs[i].used) {
+            memset(&pcbs[i], 0, sizeof(pcbs[i]));
+            pcbs[i].used = true;
+            return &pcbs[i];
+        }
+    }
+    return NULL;
+}
+
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* addr, u16_t port) {
+    for (int i = 0; i < MAX_PCBS; i++) {
+        if (&pcbs[i] != pcb && pcbs[i].used && pcbs[i].port == port) {
+            return ERR_USE;
+        }
+    }
+    pcb->port = port;
+    return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* arg) {
+    pcb->recv = recv;
+    pcb->arg = arg;
+}
+
+err_t udp_sendto(
+    struct udp_pcb* pcb,
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port
+) {
+    if (listener != NULL) {
+        const uint8_t* data = (const uint8_t*)p->payload;
+        listener(data, p->len, addr, port, listener_arg);
+    }
+    return ERR_OK;
+}
+
+void udp_remove(struct udp_pcb* pcb) {
+    pcb->used = false;
+}
+
+void udp_set_multicast_ttl(struct udp_pcb* pcb, uint8_t ttl) {
+}
+
+static void run_timeout(void* arg) {
+    Timeout* t = (Timeout*)arg;
+    std::vector<Timeout*>::iterator it =
+        std::find(timeouts.begin(), timeouts.end(), t);
+    if (it != timeouts.end()) {
+        timeouts.erase(it);
+    }
+    if (!t->cancelled) {
+        t->handler(t->arg);
+    }
+    delete t;
+}
+
+static void expire_timeout(void* arg) {
+    tcpip_callback(run_timeout, arg);
+}
+
+void sys_timeout(uint32_t ms, sys_timeout_handler handler, void* arg) {
+    Timeout* t = new Timeout();
+    t->handler = handler;
+    t->arg = arg;
+    t->cancelled = false;
+    timeouts.push_back(t);
+    sim_schedule(sim_now_us() + ms * 1000LL, expire_timeout, t);
+}
+
+// As lwIP does, cancels only the first matching timeout
+void sys_untimeout(sys_timeout_handler handler, void* arg) {
+    for (Timeout* t : timeouts) {
+        if (!t->cancelled && t->handler == handler && t->arg == arg) {
+            t->cancelled = true;
+            return;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_LWIP_H_
+#define FAKES_LWIP_H_
+
+#include <stdint.h>
+
+#include "lwip/ip_addr.h"
+
+// Emulated lwIP UDP. Datagrams sent by the code under test are handed
+// to a listener, and tests deliver datagrams to bound sockets through
+// the TCP/IP task as the network would.
+
+// Called for each datagram sent
+typedef void (*SimUdpListener)(
+    const uint8_t* data,
+    int len,
+    const ip_addr_t* addr,
+    uint16_t port,
+    void* arg
+);
+
+// Listen for datagrams sent. Only one listener is kept.
+void sim_udp_listen(SimUdpListener listener, void* arg);
+
+// Deliver a datagram from addr and from_port to the socket bound to
+// port. It is received when the TCP/IP task next runs.
+void sim_udp_deliver(
+    uint16_t port,
+    const uint8_t* data,
+    int len,
+    const ip_addr_t* from,
+    uint16_t from_port
+);
+
+// Set the address of the interface. 0.0.0.0 until set.
+void sim_netif_set_ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+
+// Groups joined with igmp_joingroup()
+int sim_igmp_groups();
+
+#endif  // FAKES_LWIP_H_
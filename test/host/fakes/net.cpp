@@ -0,0 +1,372 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Emulated TCP/IP task and SNTP client. Callbacks passed to
+// tcpip_callback() are queued to a task as lwIP does, and the SNTP
+// calls check they are made from it. Given a network, the client polls
+// a simulated NTP server over it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "lwip/apps/sntp.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "ntp.hpp"
+#include "ntp_packet.hpp"
+#include "sim.hpp"
+
+// Same as the SDK's TCPIP_MBOX_SIZE and TCPIP_THREAD_PRIO
+#define TCPIP_QUEUE_LENGTH 16
+#define TCPIP_PRIORITY 8
+
+// lwIP's SNTP_UPDATE_DELAY as set by the SDK, and lwIP's defaults for
+// SNTP_RECV_TIMEOUT and SNTP_RETRY_TIMEOUT_MAX
+#define SNTP_UPDATE_DELAY_MS 3600000
+#define SNTP_RECV_TIMEOUT_MS 15000
+#define SNTP_RETRY_TIMEOUT_MAX_MS (SNTP_RECV_TIMEOUT_MS * 10)
+
+// Seconds from the NTP epoch in 1900 to the Unix epoch
+#define NTP_UNIX_OFFSET 2208988800LL
+
+struct TcpipMessage {
+    tcpip_callback_fn fn;
+    void* ctx;
+};
+
+static QueueHandle_t tcpip_queue = NULL;
+static TaskHandle_t tcpip_task = NULL;
+
+static struct {
+    const char* server;
+    bool running;
+    int starts;
+    int misuse;
+
+    // Bumped for every request and on starting and stopping, so
+    // timeouts and responses for anything older are ignored
+    int seq;
+
+    // Delay before retrying after a lost packet
+    uint32_t retry_ms;
+} sntp;
+
+// Path to the simulated server, once set
+static SimNtpNetwork network;
+static bool network_set = false;
+static uint64_t rng_state;
+static int64_t server_offset_us;
+static bool outage;
+static SimNtpStats stats;
+
+// Address the server's name resolves to once a network is set
+static ip_addr_t server_addr;
+
+// A request or its response in flight
+struct Exchange {
+    int seq;
+    uint8_t packet[NTP_PACKET_LEN];
+
+    // The transmit timestamp sent, which must come back as the
+    // originate timestamp
+    uint8_t sent[8];
+
+    int64_t server_offset_us;
+};
+
+static void tcpip_run(void* arg) {
+    TcpipMessage msg;
+    while (true) {
+        if (xQueueReceive(tcpip_queue, &msg, portMAX_DELAY) == pdTRUE) {
+            msg.fn(msg.ctx);
+        }
+    }
+}
+
+// The raw lwIP API isn't thread safe
+static void check_tcpip_task() {
+    if (tcpip_task == NULL || xTaskGetCurrentTaskHandle() != tcpip_task) {
+        sntp.misuse++;
+    }
+}
+
+void sim_net_reset() {
+    tcpip_queue = NULL;
+    tcpip_task = NULL;
+    sntp.server = NULL;
+    sntp.running = false;
+    sntp.starts = 0;
+    sntp.misuse = 0;
+    sntp.seq = 0;
+    network_set = false;
+    server_offset_us = 0;
+    outage = false;
+    memset(&server_addr, 0, sizeof(server_addr));
+    memset(&stats, 0, sizeof(stats));
+}
+
+err_t tcpip_callback(tcpip_callback_fn function, void* ctx) {
+    // Started on first use, after the simulation has been reset
+    if (tcpip_task == NULL) {
+        tcpip_queue = xQueueCreate(TCPIP_QUEUE_LENGTH, sizeof(TcpipMessage));
+        xTaskCreate(
+            tcpip_run, "tiT", 4096, NULL, TCPIP_PRIORITY, &tcpip_task
+        );
+    }
+    TcpipMessage msg = {function, ctx};
+    if (xQueueSend(tcpip_queue, &msg, 0) != pdTRUE) {
+        return -1;
+    }
+    return ERR_OK;
+}
+
+// xorshift64, so runs are the same on every host
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static bool lose_packet() {
+    if (outage || (int)(rng() % 100) < network.loss_percent) {
+        stats.lost++;
+        return true;
+    }
+    return false;
+}
+
+static int64_t packet_delay() {
+    int64_t jitter = 0;
+    if (network.jitter_us > 0) {
+        jitter = rng() % (uint64_t)(network.jitter_us + 1);
+    }
+    return network.latency_us + jitter;
+}
+
+static uint32_t get_u32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+        | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+// Read an NTP timestamp in to microseconds since the Unix epoch. As in
+// lwIP, seconds with the top bit clear are taken to be after the NTP
+// era wraps in 2036.
+static int64_t get_timestamp(const uint8_t* buf) {
+    int64_t seconds = get_u32(buf);
+    if (seconds < 0x80000000LL) {
+        seconds += 0x100000000LL;
+    }
+    uint32_t fraction = get_u32(buf + 4);
+    return (seconds - NTP_UNIX_OFFSET) * 1000000
+        + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+static struct timeval to_timeval(int64_t us) {
+    struct timeval tv;
+    tv.tv_sec = us / 1000000;
+    tv.tv_usec = us % 1000000;
+    return tv;
+}
+
+static void sntp_request(void* arg);
+static void sntp_recv(void* arg);
+
+static void* seq_arg(int seq) {
+    return (void*)(intptr_t)seq;
+}
+
+// Wait before polling again. Runs in the TCP/IP task.
+static void sntp_schedule(uint32_t ms) {
+    sntp.seq++;
+    sys_timeout(ms, sntp_request, seq_arg(sntp.seq));
+}
+
+static void sntp_timeout(void* arg) {
+    if (!sntp.running || (intptr_t)arg != sntp.seq) {
+        return;
+    }
+    sntp_schedule(sntp.retry_ms);
+    sntp.retry_ms *= 2;
+    if (sntp.retry_ms > SNTP_RETRY_TIMEOUT_MAX_MS) {
+        sntp.retry_ms = SNTP_RETRY_TIMEOUT_MAX_MS;
+    }
+}
+
+// The response reaching the device. lwIP handles it in the TCP/IP task.
+static void response_arrived(void* arg) {
+    tcpip_callback(sntp_recv, arg);
+}
+
+// The request reaching the server, which answers it with its own clock
+static void request_arrived(void* arg) {
+    Exchange* e = (Exchange*)arg;
+
+    NtpServerState state;
+    state.stratum = 1;
+    state.leap = NTP_LEAP_NONE;
+    memcpy(&state.reference_id, "GPS", 4);
+    state.root_delay_us = 0;
+    state.root_dispersion_us = 10;
+    e->server_offset_us = server_offset_us;
+    struct timeval now = to_timeval(sim_true_us() + server_offset_us);
+    state.reference = now;
+    if (!ntp_build_response(e->packet, e->packet, &state, &now)) {
+        delete e;
+        return;
+    }
+    ntp_set_transmit_time(e->packet, &now);
+
+    if (lose_packet()) {
+        delete e;
+        return;
+    }
+    int64_t delay = packet_delay() + network.asymmetry_us;
+    sim_schedule(sim_now_us() + delay, response_arrived, e);
+}
+
+static void sntp_request(void* arg) {
+    if (!sntp.running || (intptr_t)arg != sntp.seq) {
+        return;
+    }
+
+    sntp.seq++;
+    stats.requests++;
+    sys_timeout(SNTP_RECV_TIMEOUT_MS, sntp_timeout, seq_arg(sntp.seq));
+
+    Exchange* e = new Exchange();
+    e->seq = sntp.seq;
+    memset(e->packet, 0, sizeof(e->packet));
+    e->packet[0] = (4 << 3) | 3; // Version 4 client
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    ntp_set_transmit_time(e->packet, &now);
+    memcpy(e->sent, e->packet + 40, sizeof(e->sent));
+
+    if (lose_packet()) {
+        delete e;
+        return;
+    }
+    int64_t delay = packet_delay();
+    if (network.asymmetry_us < 0) {
+        delay -= network.asymmetry_us;
+    }
+    sim_schedule(sim_now_us() + delay, request_arrived, e);
+}
+
+static void sntp_recv(void* arg) {
+    Exchange* e = (Exchange*)arg;
+    if (!sntp.running || e->seq != sntp.seq
+        || (e->packet[0] & 7) != 4
+        || memcmp(e->packet + 24, e->sent, sizeof(e->sent)) != 0) {
+        delete e;
+        return;
+    }
+
+    int64_t transmit = get_timestamp(e->packet + 40);
+    int64_t time = transmit;
+    if (network.compensate) {
+        // Offset from the four timestamps, assuming both ways take as
+        // long. time_t is treated as unsigned, as Clock does.
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        int64_t arrived = (int64_t)(uint32_t)now.tv_sec * 1000000
+            + now.tv_usec;
+        int64_t sent = get_timestamp(e->sent);
+        int64_t received = get_timestamp(e->packet + 32);
+        time = arrived + ((received - sent) + (transmit - arrived)) / 2;
+    }
+
+    struct timeval tv = to_timeval(time);
+    settimeofday(&tv, NULL);
+    stats.syncs++;
+    stats.server_offset_us = e->server_offset_us;
+    delete e;
+
+    sntp.retry_ms = SNTP_RECV_TIMEOUT_MS;
+    sntp_schedule(SNTP_UPDATE_DELAY_MS);
+}
+
+void sntp_setoperatingmode(uint8_t mode) {
+    check_tcpip_task();
+    if (sntp.running) {
+        sntp.misuse++;
+    }
+}
+
+void sntp_setservername(uint8_t idx, const char* server) {
+    check_tcpip_task();
+    // SNTP keeps the pointer and reads it on every poll
+    if (sntp.running) {
+        sntp.misuse++;
+    }
+    sntp.server = server;
+}
+
+void sntp_init() {
+    check_tcpip_task();
+    sntp.running = true;
+    sntp.starts++;
+    if (network_set) {
+        sntp.retry_ms = SNTP_RECV_TIMEOUT_MS;
+        sntp_schedule(0);
+    }
+}
+
+void sntp_stop() {
+    check_tcpip_task();
+    sntp.running = false;
+    sntp.seq++;
+}
+
+uint32_t sntp_get_sync_interval() {
+    return SNTP_UPDATE_DELAY_MS;
+}
+
+const ip_addr_t* sntp_getserver(uint8_t idx) {
+    return &server_addr;
+}
+
+const char* sim_sntp_server() {
+    return sntp.server;
+}
+
+bool sim_sntp_running() {
+    return sntp.running;
+}
+
+int sim_sntp_starts() {
+    return sntp.starts;
+}
+
+int sim_sntp_misuse() {
+    return sntp.misuse;
+}
+
+void sim_ntp_network(const SimNtpNetwork* n) {
+    network = *n;
+    network_set = true;
+    IP_ADDR4(&server_addr, 192, 0, 2, 123);
+    rng_state = n->seed ? n->seed : 1;
+}
+
+int64_t sim_true_us() {
+    return network.start_us + sim_now_us();
+}
+
+void sim_ntp_server_step(int64_t us) {
+    server_offset_us += us;
+}
+
+void sim_ntp_outage(bool down) {
+    outage = down;
+}
+
+SimNtpStats sim_ntp_stats() {
+    return stats;
+}
@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_NTP_H_
+#define FAKES_NTP_H_
+
+#include <stdint.h>
+
+// Simulated NTP server and the network between it and the SNTP client.
+//
+// Until a network is set the SNTP client only records how it is used.
+// Once set, it polls as lwIP's does: straight away when started, then
+// hourly, retrying after a lost packet from 15s and doubling up to
+// 150s. Requests and responses are real NTP packets, answered with
+// ntp_build_response() from a server whose clock is true time plus an
+// offset that tests can step. The client sets the wall clock with
+// settimeofday(), so goes through the same wrapper as on the device.
+//
+// True time runs from the virtual clock, so it never drifts.
+//
+// Once a network is set sntp_getserver() gives the server's address as
+// 192.0.2.123. Until then it is 0.0.0.0, as before lwIP has resolved
+// the name.
+
+struct SimNtpNetwork {
+    // True time at boot in microseconds since the epoch
+    int64_t start_us;
+
+    // Delay of each packet in each direction
+    int64_t latency_us;
+
+    // Largest random delay added to each packet on top of latency
+    int64_t jitter_us;
+
+    // Extra delay of responses over requests. Negative makes requests
+    // slower instead.
+    int64_t asymmetry_us;
+
+    // Chance in percent of each packet being lost
+    int loss_percent;
+
+    // Correct for the round trip, as lwIP does with
+    // SNTP_COMP_ROUNDTRIP. Without it the clock is set to the server's
+    // transmit time, so ends up behind by the response's delay.
+    bool compensate;
+
+    // Seed for the random delays and losses
+    uint64_t seed;
+};
+
+// What the SNTP client has done
+struct SimNtpStats {
+    // Requests sent and packets lost either way
+    int requests;
+    int lost;
+
+    // Responses used to set the clock
+    int syncs;
+
+    // Offset of the server's clock from true time when it answered the
+    // request behind the last sync
+    int64_t server_offset_us;
+};
+
+// Connect the SNTP client to a simulated server. Takes effect the next
+// time the client is started.
+void sim_ntp_network(const SimNtpNetwork* network);
+
+// True time in microseconds since the epoch
+int64_t sim_true_us();
+
+// Step the server's clock by us. Emulates a server that is wrong, or
+// being put right.
+void sim_ntp_server_step(int64_t us);
+
+// Lose every packet while down, as when the uplink or the server is
+// out. Cleared when the simulation is reset.
+void sim_ntp_outage(bool down);
+
+// Totals since the simulation was reset
+SimNtpStats sim_ntp_stats();
+
+#endif  // FAKES_NTP_H_
@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// In memory NVS. Namespaces are ignored as the firmware only uses one.
+
+#include <string.h>
+
+#include "nvs.h"
+#include "sim.hpp"
+
+#define MAX_ENTRIES 8
+#define MAX_KEY_LEN 16
+#define MAX_VALUE_LEN 128
+
+static struct {
+    char key[MAX_KEY_LEN];
+    char value[MAX_VALUE_LEN];
+} entries[MAX_ENTRIES];
+static int num_entries = 0;
+
+void sim_nvs_reset() {
+    num_entries = 0;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode mode, nvs_handle* handle) {
+    *handle = mode;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(
+    nvs_handle handle,
+    const char* key,
+    char* value,
+    size_t* length
+) {
+    for (int i = 0; i < num_entries; i++) {
+        if (strcmp(entries[i].key, key) == 0) {
+            size_t len = strlen(entries[i].value) + 1;
+            if (len > *length) {
+                return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(value, entries[i].value, len);
+            *length = len;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char* value) {
+    if (handle != NVS_READWRITE) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= MAX_KEY_LEN || strlen(value) >= MAX_VALUE_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int i = 0;
+    while (i < num_entries && strcmp(entries[i].key, key) != 0) {
+        i++;
+    }
+    if (i == num_entries) {
+        if (num_entries == MAX_ENTRIES) {
+            return ESP_ERR_NO_MEM;
+        }
+        num_entries++;
+    }
+    strcpy(entries[i].key, key);
+    strcpy(entries[i].value, value);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle) {
+}
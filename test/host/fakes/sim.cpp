@@ -0,0 +1,673 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "sim.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/hw_timer.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TICK_US (1000000 / configTICK_RATE_HZ)
+
+// Longest a blocking call waits for when given portMAX_DELAY. Long
+// enough to never matter, short enough that a test which deadlocks
+// still finishes.
+#define MAX_DELAY_US (24LL * 3600 * 1000000)
+
+#define MAX_GPIO_LISTENERS 8
+
+// Tasks run on their own threads, but only one thread runs at a time.
+// The test's own thread runs the simulation and hands over to a task
+// when it is ready to run, then waits for it to block again.
+struct FakeTask {
+    TaskFunction_t fn;
+    void* arg;
+    UBaseType_t priority;
+    // Waiting for done(done_arg) or until deadline. done may be NULL
+    // to wait for the deadline alone.
+    bool waiting;
+    bool (*done)(void* arg);
+    void* done_arg;
+    int64_t deadline;
+    uint32_t notify;
+    // Left blocked for good by sim_reset() or returned from fn
+    bool stopped;
+    std::condition_variable cv;
+};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool armed;
+    int64_t at;
+    int64_t period;
+};
+
+struct FakeSemaphore {
+    int count;
+    int max;
+};
+
+struct FakeQueue {
+    std::vector<char> data;
+    int item_size;
+    int length;
+    int head;
+    int count;
+};
+
+struct SimEvent {
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+static int64_t now_us = 0;
+
+// Events scheduled by tests. Events at the same time run in the order
+// they were added.
+static std::multimap<int64_t, SimEvent> events;
+
+static struct {
+    hw_timer_callback_t callback;
+    void* arg;
+    bool armed;
+    bool reload;
+    int64_t period;
+    // When the timer is due and when the interrupt actually runs
+    int64_t nominal;
+    int64_t next;
+    int jitter;
+    // Interrupts are held off until this time
+    int64_t stall_until;
+    uint64_t fires;
+} hw_timer;
+
+static std::vector<esp_timer*> esp_timers;
+static int esp_timer_tick = 0;
+static int64_t esp_timer_max_callback = 0;
+
+// Task switching. Never freed so threads still blocked at exit don't
+// wait on destroyed objects.
+static std::mutex* baton = new std::mutex();
+static std::condition_variable* main_cv = new std::condition_variable();
+static FakeTask* current_task = NULL;
+static std::vector<FakeTask*> tasks;
+
+static std::vector<FakeSemaphore*> semaphores;
+static std::vector<FakeQueue*> queues;
+
+static int gpio_levels[GPIO_NUM_MAX];
+static struct {
+    SimGpioListener fn;
+    void* arg;
+} gpio_listeners[MAX_GPIO_LISTENERS];
+static int num_gpio_listeners = 0;
+
+static int64_t ticks_to_us(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return MAX_DELAY_US;
+    }
+    return (int64_t)ticks * TICK_US;
+}
+
+static bool task_ready(FakeTask* t) {
+    if (t->stopped) {
+        return false;
+    }
+    if (!t->waiting) {
+        return true;
+    }
+    return (t->done != NULL && t->done(t->done_arg)) || now_us >= t->deadline;
+}
+
+// Hand over to a task and wait for it to block
+static void resume(FakeTask* t) {
+    std::unique_lock<std::mutex> lock(*baton);
+    current_task = t;
+    t->cv.notify_one();
+    main_cv->wait(lock, [] { return current_task == NULL; });
+}
+
+// Hand back to the simulation and wait to be resumed
+static void yield(FakeTask* t) {
+    std::unique_lock<std::mutex> lock(*baton);
+    current_task = NULL;
+    main_cv->notify_one();
+    t->cv.wait(lock, [t] { return current_task == t; });
+}
+
+static void task_entry(FakeTask* t) {
+    {
+        std::unique_lock<std::mutex> lock(*baton);
+        t->cv.wait(lock, [t] { return current_task == t; });
+    }
+    t->fn(t->arg);
+    t->stopped = true;
+    yield(t);
+}
+
+// Run every task that can run now, highest priority first, until they
+// have all blocked
+static void run_tasks() {
+    if (current_task != NULL) {
+        return;
+    }
+    for (;;) {
+        FakeTask* next = NULL;
+        for (FakeTask* t : tasks) {
+            if (task_ready(t) && (next == NULL || t->priority > next->priority)) {
+                next = t;
+            }
+        }
+        if (next == NULL) {
+            return;
+        }
+        // Move to the back so tasks of equal priority take turns
+        tasks.erase(std::find(tasks.begin(), tasks.end(), next));
+        tasks.push_back(next);
+        resume(next);
+    }
+}
+
+// Run the earliest thing due at or before limit. Returns false if
+// nothing is due.
+static bool fire_next(int64_t limit) {
+    enum { NONE, HW_TIMER, EVENT, ESP_TIMER, TASK } kind = NONE;
+    int64_t at = limit + 1;
+    esp_timer* timer = NULL;
+
+    run_tasks();
+
+    if (hw_timer.armed) {
+        int64_t next = (hw_timer.next < hw_timer.stall_until)
+            ? hw_timer.stall_until
+            : hw_timer.next;
+        if (next < at) {
+            kind = HW_TIMER;
+            at = next;
+        }
+    }
+    if (!events.empty() && events.begin()->first < at) {
+        kind = EVENT;
+        at = events.begin()->first;
+    }
+    for (esp_timer* t : esp_timers) {
+        if (t->armed && t->at < at) {
+            kind = ESP_TIMER;
+            at = t->at;
+            timer = t;
+        }
+    }
+
+    for (FakeTask* t : tasks) {
+        if (!t->stopped && t->waiting && t->deadline < at) {
+            kind = TASK;
+            at = t->deadline;
+        }
+    }
+
+    if (kind == NONE) {
+        return false;
+    }
+    if (at > now_us) {
+        now_us = at;
+    }
+
+    switch (kind) {
+    case HW_TIMER:
+        if (hw_timer.nominal < hw_timer.stall_until) {
+            // Carry on from the end of the stall rather than catching up
+            hw_timer.nominal = hw_timer.stall_until;
+        }
+        if (hw_timer.reload) {
+            hw_timer.nominal += hw_timer.period;
+            hw_timer.next = hw_timer.nominal
+                + (hw_timer.jitter ? rand() % (hw_timer.jitter + 1) : 0);
+        }
+        else {
+            hw_timer.armed = false;
+        }
+        hw_timer.fires++;
+        hw_timer.callback(hw_timer.arg);
+        break;
+    case EVENT:
+    {
+        SimEvent event = events.begin()->second;
+        events.erase(events.begin());
+        event.fn(event.arg);
+        break;
+    }
+    case ESP_TIMER:
+        if (timer->period != 0) {
+            timer->at += timer->period;
+        }
+        else {
+            timer->armed = false;
+        }
+        timer->callback(timer->arg);
+        if (now_us - at > esp_timer_max_callback) {
+            esp_timer_max_callback = now_us - at;
+        }
+        break;
+    case TASK:
+        // Picked up by run_tasks() next time round
+        break;
+    case NONE:
+        break;
+    }
+    return true;
+}
+
+int64_t sim_now_us() {
+    return now_us;
+}
+
+void sim_run_until(int64_t time) {
+    while (fire_next(time)) {
+    }
+    if (time > now_us) {
+        now_us = time;
+    }
+}
+
+bool sim_run_until(bool (*done)(void* arg), void* arg, int64_t deadline) {
+    while (!done(arg)) {
+        if (!fire_next(deadline)) {
+            if (deadline > now_us) {
+                now_us = deadline;
+            }
+            return done(arg);
+        }
+    }
+    return true;
+}
+
+// Block until done(arg) is true or the clock reaches deadline. A task
+// hands back to the simulation while it waits. Anything else runs the
+// simulation forward itself.
+static bool block(bool (*done)(void* arg), void* arg, int64_t deadline) {
+    FakeTask* t = current_task;
+    if (t == NULL) {
+        if (done == NULL) {
+            sim_run_until(deadline);
+            return false;
+        }
+        return sim_run_until(done, arg, deadline);
+    }
+    t->waiting = true;
+    t->done = done;
+    t->done_arg = arg;
+    t->deadline = deadline;
+    yield(t);
+    t->waiting = false;
+    return done != NULL && done(arg);
+}
+
+// Deadline for a blocking call with a timeout in ticks. Tasks can wait
+// forever, but the test itself never does so a deadlock still ends.
+static int64_t deadline_after(TickType_t ticks) {
+    if (ticks == portMAX_DELAY && current_task != NULL) {
+        return INT64_MAX;
+    }
+    return now_us + ticks_to_us(ticks);
+}
+
+void sim_schedule(int64_t time, void (*fn)(void* arg), void* arg) {
+    SimEvent event = {fn, arg};
+    events.insert(std::make_pair(time, event));
+}
+
+void sim_reset() {
+    now_us = 0;
+    events.clear();
+    memset(&hw_timer, 0, sizeof(hw_timer));
+    for (esp_timer* t : esp_timers) {
+        delete t;
+    }
+    esp_timers.clear();
+    esp_timer_tick = 0;
+    esp_timer_max_callback = 0;
+    // Threads can't be killed, so tasks are left blocked for good
+    for (FakeTask* t : tasks) {
+        t->stopped = true;
+    }
+    tasks.clear();
+    for (FakeSemaphore* s : semaphores) {
+        delete s;
+    }
+    semaphores.clear();
+    for (FakeQueue* q : queues) {
+        delete q;
+    }
+    queues.clear();
+    memset(gpio_levels, 0, sizeof(gpio_levels));
+    num_gpio_listeners = 0;
+    sim_lwip_reset();
+    sim_net_reset();
+    sim_nvs_reset();
+    sim_wall_reset();
+}
+
+void sim_gpio_listen(SimGpioListener listener, void* arg) {
+    if (num_gpio_listeners < MAX_GPIO_LISTENERS) {
+        gpio_listeners[num_gpio_listeners].fn = listener;
+        gpio_listeners[num_gpio_listeners].arg = arg;
+        num_gpio_listeners++;
+    }
+}
+
+int sim_gpio_level(int pin) {
+    return gpio_levels[pin];
+}
+
+void sim_hw_timer_jitter(int max_us, unsigned int seed) {
+    hw_timer.jitter = max_us;
+    srand(seed);
+}
+
+void sim_hw_timer_stall(int64_t until) {
+    hw_timer.stall_until = until;
+}
+
+uint64_t sim_hw_timer_fires() {
+    return hw_timer.fires;
+}
+
+void sim_esp_timer_tick(int tick_us) {
+    esp_timer_tick = tick_us;
+}
+
+int64_t sim_esp_timer_max_callback_us() {
+    return esp_timer_max_callback;
+}
+
+// GPIO
+
+esp_err_t gpio_config(const gpio_config_t* config) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    int pin = gpio_num;
+    int value = level ? 1 : 0;
+    if (pin < 0 || pin >= GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (gpio_levels[pin] != value) {
+        gpio_levels[pin] = value;
+        for (int i = 0; i < num_gpio_listeners; i++) {
+            gpio_listeners[i].fn(pin, value, gpio_listeners[i].arg);
+        }
+    }
+    return ESP_OK;
+}
+
+// Hardware timer
+
+esp_err_t hw_timer_init(hw_timer_callback_t callback, void* arg) {
+    hw_timer.callback = callback;
+    hw_timer.arg = arg;
+    hw_timer.armed = false;
+    return ESP_OK;
+}
+
+esp_err_t hw_timer_deinit() {
+    hw_timer.callback = NULL;
+    hw_timer.armed = false;
+    return ESP_OK;
+}
+
+esp_err_t hw_timer_alarm_us(uint32_t value, bool reload) {
+    hw_timer.period = value;
+    hw_timer.reload = reload;
+    hw_timer.nominal = now_us + value;
+    hw_timer.next = hw_timer.nominal;
+    hw_timer.armed = true;
+    return ESP_OK;
+}
+
+esp_err_t hw_timer_disarm() {
+    hw_timer.armed = false;
+    return ESP_OK;
+}
+
+// esp_timer
+
+int64_t esp_timer_get_time() {
+    return now_us;
+}
+
+esp_err_t esp_timer_create(
+    const esp_timer_create_args_t* args,
+    esp_timer_handle_t* handle
+) {
+    esp_timer* t = new esp_timer();
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->armed = false;
+    esp_timers.push_back(t);
+    *handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (esp_timer_tick > 0) {
+        // Counted in whole ticks, rounding down, from the last tick
+        int64_t ticks = timeout_us / esp_timer_tick;
+        if (ticks < 1) {
+            ticks = 1;
+        }
+        timer->at = (now_us / esp_timer_tick + ticks) * esp_timer_tick;
+    }
+    else {
+        timer->at = now_us + timeout_us;
+    }
+    timer->period = 0;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    timer->at = now_us + period;
+    timer->period = period;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    timer->armed = false;
+    return ESP_OK;
+}
+
+// System
+
+uint32_t esp_get_free_heap_size() {
+    return 40000;
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+    return 40000;
+}
+
+// FreeRTOS
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)(now_us / TICK_US);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    block(NULL, NULL, now_us + ticks_to_us(ticks));
+}
+
+void vTaskDelayUntil(TickType_t* previous_wake, TickType_t increment) {
+    *previous_wake += increment;
+    block(NULL, NULL, (int64_t)*previous_wake * TICK_US);
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t fn,
+    const char* name,
+    uint32_t stack_size,
+    void* arg,
+    UBaseType_t priority,
+    TaskHandle_t* handle
+) {
+    FakeTask* t = new FakeTask();
+    t->fn = fn;
+    t->arg = arg;
+    t->priority = priority;
+    t->waiting = false;
+    t->done = NULL;
+    t->notify = 0;
+    t->stopped = false;
+    tasks.push_back(t);
+    std::thread(task_entry, t).detach();
+    if (handle != NULL) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return current_task;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 1024;
+}
+
+static bool notified(void* arg) {
+    return ((FakeTask*)arg)->notify > 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) {
+    FakeTask* t = current_task;
+    if (t->notify == 0 && timeout != 0) {
+        block(notified, t, deadline_after(timeout));
+    }
+    uint32_t value = t->notify;
+    if (value > 0) {
+        t->notify = clear ? 0 : value - 1;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    task->notify++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+    task->notify++;
+}
+
+static SemaphoreHandle_t create_semaphore(int max, int initial) {
+    FakeSemaphore* s = new FakeSemaphore();
+    s->max = max;
+    s->count = initial;
+    semaphores.push_back(s);
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return create_semaphore(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return create_semaphore(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(
+    UBaseType_t max_count,
+    UBaseType_t initial_count
+) {
+    return create_semaphore(max_count, initial_count);
+}
+
+static bool semaphore_available(void* arg) {
+    return ((FakeSemaphore*)arg)->count > 0;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    if (semaphore->count == 0 && timeout != 0) {
+        block(semaphore_available, semaphore, deadline_after(timeout));
+    }
+    if (semaphore->count == 0) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    if (semaphore->count >= semaphore->max) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(
+    SemaphoreHandle_t semaphore,
+    BaseType_t* higher_priority_task_woken
+) {
+    return xSemaphoreGive(semaphore);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    FakeQueue* q = new FakeQueue();
+    q->data.resize(length * item_size);
+    q->item_size = item_size;
+    q->length = length;
+    q->head = 0;
+    q->count = 0;
+    queues.push_back(q);
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout) {
+    if (queue->count == queue->length) {
+        return pdFALSE;
+    }
+    int slot = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->data[slot * queue->item_size], item, queue->item_size);
+    queue->count++;
+    return pdTRUE;
+}
+
+static bool queue_not_empty(void* arg) {
+    return ((FakeQueue*)arg)->count > 0;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout) {
+    if (queue->count == 0 && timeout != 0) {
+        block(queue_not_empty, queue, deadline_after(timeout));
+    }
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, &queue->data[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_SIM_H_
+#define FAKES_SIM_H_
+
+#include <stdint.h>
+
+// Discrete event simulation behind the SDK fakes.
+//
+// There is one virtual clock counting microseconds since boot. Nothing
+// happens between events, so simulated hours take as long as the work
+// done in them. The hardware timer, esp_timers and events scheduled by
+// tests all fire from here in time order. Anything in the code under
+// test that would block, such as taking a semaphore, runs the
+// simulation forward until it can continue.
+//
+// FreeRTOS tasks each get a thread, but only one thread runs at a time.
+// Whenever the simulation is run, tasks that are ready run at the
+// current virtual time, highest priority first, until they block. A
+// task blocking hands back to the simulation rather than running it.
+
+// Virtual time in microseconds since boot
+int64_t sim_now_us();
+
+// Run all events due up to and including time, then leave the clock at
+// time
+void sim_run_until(int64_t time);
+
+// Run events until done(arg) is true or the clock reaches deadline.
+// Returns the final value of done(arg).
+bool sim_run_until(bool (*done)(void* arg), void* arg, int64_t deadline);
+
+// Call fn(arg) at the given time
+void sim_schedule(int64_t time, void (*fn)(void* arg), void* arg);
+
+// Put the simulation back to its state at boot. Timers, semaphores and
+// listeners created before this must not be used after it.
+void sim_reset();
+
+// Called on every change of a GPIO level
+typedef void (*SimGpioListener)(int pin, int level, void* arg);
+
+// Listen for GPIO changes. Up to 8 listeners may be added
+void sim_gpio_listen(SimGpioListener listener, void* arg);
+
+// Current level of a pin
+int sim_gpio_level(int pin);
+
+// Make each hardware timer interrupt late by up to max_us, chosen at
+// random. Emulates interrupts being held off by WiFi.
+void sim_hw_timer_jitter(int max_us, unsigned int seed);
+
+// Hold off the hardware timer interrupt until time. Emulates the bus
+// stalling for long enough that writes time out.
+void sim_hw_timer_stall(int64_t until);
+
+// Number of times the hardware timer interrupt has run
+uint64_t sim_hw_timer_fires();
+
+// Run one shot esp_timers from a tick of tick_us, as the SDK does from
+// the RTOS tick. Timeouts are counted in whole ticks, rounding down,
+// from the last tick, so a timer can fire up to two ticks early. 0
+// fires them exactly on time.
+void sim_esp_timer_tick(int tick_us);
+
+// Longest time an esp_timer callback has taken. Callbacks only take
+// time if they block.
+int64_t sim_esp_timer_max_callback_us();
+
+// Name SNTP was last given. SNTP keeps the pointer rather than a copy.
+const char* sim_sntp_server();
+
+// Whether the SNTP client is running
+bool sim_sntp_running();
+
+// Number of times the SNTP client has been started
+int sim_sntp_starts();
+
+// Number of SNTP calls made from outside the TCP/IP task or that change
+// its settings while it is running
+int sim_sntp_misuse();
+
+// Used by sim_reset() to clear the network, NVS and wall clock fakes
+void sim_lwip_reset();
+void sim_net_reset();
+void sim_nvs_reset();
+void sim_wall_reset();
+
+#endif  // FAKES_SIM_H_
@@ -0,0 +1,172 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "tm1637_decoder.hpp"
+
+#include "sim.hpp"
+
+// Segments for each hex digit, as sent by the driver
+static const uint8_t digit_segments[16] = {
+    0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07,
+    0x7F, 0x6F, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71,
+};
+
+#define COLON 0x80
+
+void Tm1637Decoder::Byte(uint8_t value) {
+    bytes_.push_back(value);
+
+    if (index_++ != 0) {
+        // Data following an address command
+        ram_[address_ % 6] = value;
+        if (!fixed_address_) {
+            address_++;
+        }
+        updated_ = true;
+        return;
+    }
+
+    switch (value & 0xC0) {
+    case 0x40: // Data command
+        fixed_address_ = (value & 0x04) != 0;
+        break;
+    case 0x80: // Display control
+        on_ = (value & 0x08) != 0;
+        brightness_ = value & 0x07;
+        updated_ = true;
+        break;
+    case 0xC0: // Address
+        address_ = value & 0x07;
+        break;
+    default:
+        errors_++;
+        break;
+    }
+}
+
+void Tm1637Decoder::OnGpio(int pin, int level, void* arg) {
+    Tm1637Decoder* d = (Tm1637Decoder*)arg;
+
+    if (pin == d->dio_) {
+        d->dio_level_ = level;
+        if (d->clk_level_ == 0) {
+            return;
+        }
+
+        // Data changing while the clock is high is a start or stop. A
+        // stop is preceded by one clock pulse of its own, anything more
+        // means a byte was cut short.
+        if (d->bit_ > 1) {
+            d->errors_++;
+        }
+        d->bit_ = 0;
+        d->byte_ = 0;
+        if (level == 0) {
+            d->starts_++;
+            d->in_transfer_ = true;
+            d->bit_ = 0;
+            d->byte_ = 0;
+            d->index_ = 0;
+            d->updated_ = false;
+        }
+        else {
+            d->stops_++;
+            d->last_stop_us_ = sim_now_us();
+            if (d->in_transfer_ && d->updated_ && d->on_update_ != NULL) {
+                d->on_update_(d, d->on_update_arg_);
+            }
+            d->in_transfer_ = false;
+        }
+    }
+    else if (pin == d->clk_) {
+        d->clk_level_ = level;
+        if (level == 0 || !d->in_transfer_) {
+            return;
+        }
+
+        // Data is sampled on the rising edge, LSB first, followed by
+        // the ack bit which the chip drives low
+        if (d->bit_ < 8) {
+            d->byte_ |= d->dio_level_ << d->bit_;
+            d->bit_++;
+        }
+        else {
+            if (d->dio_level_ != 0) {
+                d->errors_++;
+            }
+            d->Byte(d->byte_);
+            d->bit_ = 0;
+            d->byte_ = 0;
+        }
+    }
+}
+
+Tm1637Decoder::Tm1637Decoder(int dio, int clk) {
+    dio_ = dio;
+    clk_ = clk;
+    dio_level_ = sim_gpio_level(dio);
+    clk_level_ = sim_gpio_level(clk);
+    sim_gpio_listen(OnGpio, this);
+}
+
+void Tm1637Decoder::SetOnUpdate(
+    void (*fn)(Tm1637Decoder* decoder, void* arg),
+    void* arg
+) {
+    on_update_ = fn;
+    on_update_arg_ = arg;
+}
+
+uint8_t Tm1637Decoder::Segments(int pos) {
+    return ram_[pos];
+}
+
+void Tm1637Decoder::SetSegments(int pos, uint8_t segments) {
+    ram_[pos] = segments;
+}
+
+int Tm1637Decoder::Digit(int pos) {
+    uint8_t segments = ram_[pos] & ~COLON;
+    for (int i = 0; i < 16; i++) {
+        if (digit_segments[i] == segments) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool Tm1637Decoder::Colon() {
+    return (ram_[1] & COLON) != 0;
+}
+
+bool Tm1637Decoder::On() {
+    return on_;
+}
+
+int Tm1637Decoder::Brightness() {
+    return brightness_;
+}
+
+const std::vector<uint8_t>& Tm1637Decoder::Bytes() {
+    return bytes_;
+}
+
+void Tm1637Decoder::ClearBytes() {
+    bytes_.clear();
+}
+
+int Tm1637Decoder::Starts() {
+    return starts_;
+}
+
+int Tm1637Decoder::Stops() {
+    return stops_;
+}
+
+int Tm1637Decoder::Errors() {
+    return errors_;
+}
+
+int64_t Tm1637Decoder::LastStopUs() {
+    return last_stop_us_;
+}
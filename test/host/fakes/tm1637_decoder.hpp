@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_TM1637_DECODER_H_
+#define FAKES_TM1637_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Emulates a TM1637 listening on a pair of simulated GPIOs.
+//
+// Decodes start and stop conditions and bytes clocked out on the pins,
+// and applies the commands to its own copy of the display RAM the way
+// the real chip does. Anything that breaks the protocol, such as a
+// start or stop part way through a byte, is counted as an error.
+class Tm1637Decoder
+{
+private:
+    int dio_;
+    int clk_;
+
+    // Levels last seen on the pins
+    int dio_level_ = 1;
+    int clk_level_ = 1;
+
+    // Position within the current transfer
+    bool in_transfer_ = false;
+    int bit_ = 0;
+    int byte_ = 0;
+    int index_ = 0;
+    bool updated_ = false;
+
+    // State of the emulated chip
+    bool fixed_address_ = false;
+    int address_ = 0;
+    uint8_t ram_[6] = {0};
+    bool on_ = false;
+    int brightness_ = 0;
+
+    std::vector<uint8_t> bytes_;
+    int starts_ = 0;
+    int stops_ = 0;
+    int errors_ = 0;
+    int64_t last_stop_us_ = 0;
+
+    void (*on_update_)(Tm1637Decoder* decoder, void* arg) = NULL;
+    void* on_update_arg_ = NULL;
+
+    // Apply a complete byte
+    void Byte(uint8_t value);
+
+    // Listener for pin changes
+    static void OnGpio(int pin, int level, void* arg);
+
+public:
+    // Constructor. Start listening on the given pins
+    Tm1637Decoder(int dio, int clk);
+
+    // Set a function to call at the end of each transfer that changed
+    // the display
+    void SetOnUpdate(void (*fn)(Tm1637Decoder* decoder, void* arg), void* arg);
+
+    // Segments shown at pos
+    uint8_t Segments(int pos);
+
+    // Value of the digit shown at pos or -1 if it isn't a hex digit
+    int Digit(int pos);
+
+    // Overwrite the segments at pos, as a garbled transfer would
+    void SetSegments(int pos, uint8_t segments);
+
+    // Is the colon lit
+    bool Colon();
+
+    // Display control state
+    bool On();
+    int Brightness();
+
+    // Every byte seen, in order
+    const std::vector<uint8_t>& Bytes();
+    void ClearBytes();
+
+    int Starts();
+    int Stops();
+    int Errors();
+
+    // Time of the last stop condition in us since boot
+    int64_t LastStopUs();
+};
+
+#endif  // FAKES_TM1637_DECODER_H_
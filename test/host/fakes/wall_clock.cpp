@@ -0,0 +1,64 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "wall_clock.hpp"
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "sim.hpp"
+
+static struct {
+    // Wall clock time at virtual time set_at
+    int64_t base_us;
+    int64_t set_at;
+    int ppm;
+} wall;
+
+void sim_wall_reset() {
+    wall.base_us = 0;
+    wall.set_at = sim_now_us();
+    wall.ppm = 0;
+}
+
+int64_t sim_wall_us() {
+    int64_t elapsed = sim_now_us() - wall.set_at;
+    return wall.base_us + elapsed + elapsed * wall.ppm / 1000000;
+}
+
+void sim_wall_set_us(int64_t us) {
+    wall.base_us = us;
+    wall.set_at = sim_now_us();
+}
+
+void sim_wall_drift(int ppm) {
+    // Keep the time so far at the old rate
+    sim_wall_set_us(sim_wall_us());
+    wall.ppm = ppm;
+}
+
+// These replace the C library's for the whole test binary, so tests
+// never read or set the host's clock. Code linked with
+// --wrap=settimeofday reaches settimeofday() through __real_settimeofday.
+
+extern "C" int gettimeofday(
+    struct timeval* __restrict tv,
+    void* __restrict tz
+) noexcept {
+    int64_t us = sim_wall_us();
+    tv->tv_sec = (time_t)(int32_t)(uint32_t)(us / 1000000);
+    tv->tv_usec = us % 1000000;
+    return 0;
+}
+
+extern "C" int settimeofday(
+    const struct timeval* tv,
+    const struct timezone* tz
+) noexcept {
+    if (tv != NULL) {
+        // Treated as unsigned, as Clock does, until 2106
+        int64_t seconds = (uint32_t)tv->tv_sec;
+        sim_wall_set_us(seconds * 1000000 + tv->tv_usec);
+    }
+    return 0;
+}
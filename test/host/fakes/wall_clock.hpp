@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKES_WALL_CLOCK_H_
+#define FAKES_WALL_CLOCK_H_
+
+#include <stdint.h>
+
+// Emulated wall clock behind gettimeofday() and settimeofday().
+//
+// The wall clock runs from the virtual clock, gaining or losing at the
+// drift set, and starts at the epoch as it does on the device after a
+// reset. tv_sec is truncated to 32 bits as time_t is on the device, so
+// it goes negative in January 2038 just as it does there.
+
+// Wall clock time in microseconds since the epoch, without the 32 bit
+// truncation
+int64_t sim_wall_us();
+
+// Set the wall clock, bypassing anything that wraps settimeofday()
+void sim_wall_set_us(int64_t us);
+
+// Make the wall clock gain ppm parts per million on the virtual clock.
+// Negative values make it lose time.
+void sim_wall_drift(int ppm);
+
+#endif  // FAKES_WALL_CLOCK_H_
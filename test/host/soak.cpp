@@ -0,0 +1,549 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Accelerated soak of the clock's timekeeping.
+//
+// Runs the firmware's clock task and display task on the simulated RTOS
+// for months of virtual time. SNTP polls a simulated server and sets
+// the emulated wall clock through the same settimeofday() wrapper as on
+// the device, the crystal drifts, and there are outages, bad steps from
+// the server and reboots that lose the time. The display's pins are
+// decoded by an emulated TM1637. The default run starts two or three
+// days before a 32 bit time_t goes negative in January 2038.
+//
+// Every frame shown is checked against an oracle that works from the
+// wall clock in 64 bits with the C library's gmtime_r(), and against
+// true time whenever the clock should be in sync. The clock's fields
+// are checked the same way every second.
+//
+//   soak [days] [seed]
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <chrono>
+#include <vector>
+
+#include "accuracy.hpp"
+#include "clock.hpp"
+#include "clock_task.hpp"
+#include "display_bus.hpp"
+#include "tm1637.hpp"
+#include "fakes/ntp.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/tm1637_decoder.hpp"
+#include "fakes/wall_clock.hpp"
+#include "test.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define SECOND_US 1000000LL
+#define HOUR_US (3600 * SECOND_US)
+#define DAY_US (24 * HOUR_US)
+
+// 2038-01-17 00:00:00 UTC
+#define DEFAULT_START 2147299200LL
+
+// 2038-01-19 03:14:08 UTC, where a 32 bit time_t goes negative
+#define TIME_T_WRAP 2147483648LL
+
+// Time from boot to the clock being created, covering the WiFi
+// connection
+#define CONNECT_US (8 * SECOND_US)
+
+// Network to the server. SNTP sets the clock to the server's transmit
+// time, so the clock can be behind by up to a response's delay.
+#define LATENCY_US 5000
+#define JITTER_US 10000
+#define LOSS_PERCENT 1
+
+// Slack in the sync checks for rounding
+#define MARGIN_US 1000
+
+// Longest from the clock task reading the clock to the frame reaching
+// the display
+#define WRITE_LAG_US 50000
+
+// Largest drift of the crystal
+#define MAX_PPM 100
+
+// Mean time between each kind of fault, often enough that the default
+// run sees each of them, and the longest outage
+#define OUTAGE_EVERY_US (2 * DAY_US)
+#define BAD_STEP_EVERY_US DAY_US
+#define REBOOT_EVERY_US (2 * DAY_US)
+#define MAX_OUTAGE_US (12 * HOUR_US)
+
+// Only report the first few failures of each kind
+#define MAX_REPORTS 5
+
+static uint64_t rng_state;
+
+// xorshift64, so runs are the same on every host
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int64_t rng_range(int64_t lo, int64_t hi) {
+    return lo + (int64_t)(rng() % (uint64_t)(hi - lo + 1));
+}
+
+// Time until the next of a fault that happens on average every mean_us
+static int64_t rng_interval(int64_t mean_us) {
+    return rng_range(mean_us / 4, mean_us * 7 / 4);
+}
+
+struct Soak {
+    // True time at the start of the soak
+    int64_t start_us;
+
+    // Time into the soak the current boot started. The virtual clock
+    // starts again from 0 on each boot.
+    int64_t boot_us;
+
+    Clock* clock;
+    int ppm;
+
+    // Next time each fault happens, as time into the soak
+    int64_t outage_start;
+    int64_t outage_end;
+    int64_t next_bad_step;
+    int64_t next_reboot;
+
+    // Step the server has been given that no sync has used yet
+    int64_t step_pending;
+
+    // Syncs seen since boot, Clock's count when it booted and the time
+    // into the soak syncs were last looked for
+    int syncs_seen;
+    int sync_base;
+    int64_t last_check;
+
+    // Time into the soak of the last good sync, or -1 if there has been
+    // none since boot, and whether the last sync was a bad step
+    int64_t last_good_sync;
+    bool bad_step;
+
+    // Syncs seen when the last frame was decoded and when the clock
+    // was last sampled
+    int frame_syncs;
+    int sample_syncs;
+
+    // Minute shown by the last frame while in sync, or -1 if a sync or
+    // losing sync came since, and how late each change was in true time
+    int stretch_shown;
+    uint32_t changes;
+    int64_t total_late_us;
+    int64_t max_late_us;
+
+    // Committed frames against the device's clock as /api/accuracy
+    // sees them
+    DisplayAccuracy device;
+
+    // Counts for the report
+    uint64_t frames;
+    uint64_t frames_wrapped;
+    int syncs;
+    int outages;
+    int bad_steps;
+    int reboots;
+
+    // Failures
+    int bad_digit;
+    int wrong_frame;
+    int late_frame;
+    int late_change;
+    int wrong_fields;
+    int wrong_us;
+    int out_of_sync;
+    int wrong_sync_record;
+    int bus_errors;
+};
+
+static int64_t soak_now(const Soak* s) {
+    return s->boot_us + sim_now_us();
+}
+
+// Minute of the day at us since the epoch, from the C library
+static int minute_of_day(int64_t us) {
+    time_t seconds = us / SECOND_US;
+    if (us % SECOND_US < 0) {
+        seconds--;
+    }
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    return tm.tm_hour * 60 + tm.tm_min;
+}
+
+// How far the clock may be from true time since the last good sync
+static int64_t sync_bound(const Soak* s) {
+    int64_t age = soak_now(s) - s->last_good_sync;
+    return LATENCY_US + JITTER_US + age * abs(s->ppm) / 1000000 + MARGIN_US;
+}
+
+static bool in_sync(const Soak* s) {
+    return s->last_good_sync >= 0 && !s->bad_step;
+}
+
+// Note any syncs since the last check. A sync from a stepped server is
+// a bad step, after which the server is put right for the next poll.
+static void check_syncs(Soak* s) {
+    SimNtpStats stats = sim_ntp_stats();
+    if (stats.syncs != s->syncs_seen) {
+        s->syncs += stats.syncs - s->syncs_seen;
+        s->syncs_seen = stats.syncs;
+        s->bad_step = stats.server_offset_us != 0;
+        if (s->bad_step) {
+            s->bad_steps++;
+            sim_ntp_server_step(-s->step_pending);
+            s->step_pending = 0;
+        }
+        else {
+            // It happened some time since the last check
+            s->last_good_sync = s->last_check;
+        }
+    }
+    s->last_check = soak_now(s);
+}
+
+// Frames decoded from the display's pins
+static void on_update(Tm1637Decoder* decoder, void* arg) {
+    Soak* s = (Soak*)arg;
+    check_syncs(s);
+
+    // The driver ends each frame with the display control command.
+    // Runs of digits sent from separate addresses land a byte or two
+    // apart, so wait for the whole frame.
+    const std::vector<uint8_t>& bytes = decoder->Bytes();
+    bool complete = !bytes.empty() && (bytes.back() & 0xC0) == 0x80;
+    decoder->ClearBytes();
+    if (!complete) {
+        return;
+    }
+
+    char digits[CLOCK_TASK_DIGITS];
+    for (int i = 0; i < CLOCK_TASK_DIGITS; i++) {
+        int digit = decoder->Digit(i);
+        if (digit < 0 || digit > 9) {
+            if (s->bad_digit++ < MAX_REPORTS) {
+                printf("showed segments %02x\n", decoder->Segments(i));
+            }
+            return;
+        }
+        digits[i] = digit;
+    }
+    int shown = (digits[0] * 10 + digits[1]) * 60 + digits[2] * 10 + digits[3];
+    s->frames++;
+
+    // The frame was rendered from the wall clock up to WRITE_LAG_US ago,
+    // unless SNTP has set it since the last frame
+    int64_t wall = sim_wall_us();
+    if (wall >= TIME_T_WRAP * SECOND_US) {
+        s->frames_wrapped++;
+    }
+    if (s->syncs_seen == s->frame_syncs
+        && shown != minute_of_day(wall)
+        && shown != minute_of_day(wall - WRITE_LAG_US)
+        && s->wrong_frame++ < MAX_REPORTS) {
+        printf(
+            "at %lld s showed %d%d:%d%d\n",
+            (long long)(wall / SECOND_US),
+            digits[0], digits[1], digits[2], digits[3]
+        );
+    }
+    bool synced = s->syncs_seen != s->frame_syncs;
+    s->frame_syncs = s->syncs_seen;
+
+    // A sync can step what is shown, so only changes between frames in
+    // the same stretch of sync are timed
+    if (!in_sync(s) || synced) {
+        s->stretch_shown = -1;
+    }
+    if (!in_sync(s)) {
+        return;
+    }
+
+    // Within what the sync and drift allow of true time
+    int64_t now = sim_true_us();
+    int64_t allowed = sync_bound(s);
+    if (shown != minute_of_day(now + allowed)
+        && shown != minute_of_day(now - WRITE_LAG_US - allowed)
+        && s->late_frame++ < MAX_REPORTS) {
+        printf(
+            "at true %lld s showed %d%d:%d%d, allowed %lld us\n",
+            (long long)(now / SECOND_US),
+            digits[0], digits[1], digits[2], digits[3],
+            (long long)allowed
+        );
+    }
+
+    // A new minute reaches the display within a second of the clock
+    // task's period, as it reads the clock once a second
+    if (s->stretch_shown >= 0 && shown != s->stretch_shown) {
+        int64_t late = now % DAY_US - shown * 60 * SECOND_US;
+        if (late < -DAY_US / 2) {
+            late += DAY_US;
+        }
+        else if (late > DAY_US / 2) {
+            late -= DAY_US;
+        }
+        s->changes++;
+        s->total_late_us += late;
+        if (late > s->max_late_us) {
+            s->max_late_us = late;
+        }
+        if ((late < -allowed || late > SECOND_US + WRITE_LAG_US + allowed)
+            && s->late_change++ < MAX_REPORTS) {
+            printf(
+                "at true %lld s change shown %lld us late, allowed %lld\n",
+                (long long)(now / SECOND_US),
+                (long long)late,
+                (long long)allowed
+            );
+        }
+    }
+    s->stretch_shown = shown;
+}
+
+// What main.cpp records for /api/accuracy
+static void on_commit(const char* frame, int len, void* arg) {
+    Soak* s = (Soak*)arg;
+    s->device.Record(frame, len, Clock::NowUs());
+}
+
+// What the firmware's display task is given
+struct Device {
+    TM1637* display;
+    QueueHandle_t queue;
+    ClockTaskArgs clock_task;
+};
+
+static void task_display(void* arg) {
+    Device* d = (Device*)arg;
+    d->display->WaitForMsg(&d->queue);
+}
+
+// Every second, inject faults and check the clock
+static void sample(void* arg) {
+    Soak* s = (Soak*)arg;
+    sim_schedule(sim_now_us() + SECOND_US, sample, s);
+    check_syncs(s);
+
+    int64_t now = soak_now(s);
+    bool outage = now >= s->outage_start && now < s->outage_end;
+    sim_ntp_outage(outage);
+    if (now >= s->outage_end) {
+        s->outages++;
+        s->outage_start = now + rng_interval(OUTAGE_EVERY_US);
+        s->outage_end = s->outage_start + rng_range(HOUR_US, MAX_OUTAGE_US);
+    }
+
+    // Now and then the server is wrong by hours until the next poll
+    if (now >= s->next_bad_step) {
+        s->next_bad_step = now + rng_interval(BAD_STEP_EVERY_US);
+        if (s->step_pending == 0) {
+            s->step_pending = rng_range(0, 1) ? 2 * HOUR_US : -2 * HOUR_US;
+            sim_ntp_server_step(s->step_pending);
+        }
+    }
+
+    // The clock's fields against the oracle
+    Clock* clock = s->clock;
+    clock->Now();
+    int64_t wall = sim_wall_us();
+    time_t seconds = wall / SECOND_US;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    if ((clock->Hour() != tm.tm_hour
+        || clock->Minute() != tm.tm_min
+        || clock->Second() != tm.tm_sec
+        || clock->Microsecond() != wall % SECOND_US)
+        && s->wrong_fields++ < MAX_REPORTS) {
+        printf(
+            "at %lld s clock gave %d:%d:%d\n",
+            (long long)seconds,
+            clock->Hour(), clock->Minute(), clock->Second()
+        );
+    }
+    if (Clock::NowUs() != wall && s->wrong_us++ < MAX_REPORTS) {
+        printf(
+            "at %lld s NowUs() gave %lld\n",
+            (long long)seconds,
+            (long long)Clock::NowUs()
+        );
+    }
+
+    // Clock saw every sync SNTP made, and the time of any since the last
+    // sample. The host keeps Clock's record across reboots, so count
+    // from boot.
+    bool recorded = clock->SyncCount() - s->sync_base == s->syncs_seen;
+    if (s->syncs_seen != s->sample_syncs) {
+        uint32_t since = (uint32_t)seconds - (uint32_t)clock->LastSync();
+        recorded = recorded && since <= 2;
+    }
+    if (!recorded && s->wrong_sync_record++ < MAX_REPORTS) {
+        printf(
+            "at %lld s clock recorded %d syncs, last at %lld\n",
+            (long long)seconds,
+            clock->SyncCount() - s->sync_base,
+            (long long)clock->LastSync()
+        );
+    }
+    s->sample_syncs = s->syncs_seen;
+
+    // Within what the sync and drift allow of true time
+    if (in_sync(s)) {
+        int64_t allowed = sync_bound(s);
+        int64_t error = wall - sim_true_us();
+        if ((error > allowed || error < -allowed)
+            && s->out_of_sync++ < MAX_REPORTS) {
+            printf(
+                "at %lld s %lld us from true time, allowed %lld\n",
+                (long long)seconds,
+                (long long)error,
+                (long long)allowed
+            );
+        }
+    }
+}
+
+// Boot the device and run it for duration. The time is lost and the
+// crystal runs at its own rate.
+static void boot(Soak* s, int64_t duration) {
+    sim_reset();
+    s->ppm = rng_range(-MAX_PPM, MAX_PPM);
+    sim_wall_drift(s->ppm);
+
+    SimNtpNetwork network;
+    network.start_us = s->start_us + s->boot_us;
+    network.latency_us = LATENCY_US;
+    network.jitter_us = JITTER_US;
+    network.asymmetry_us = 0;
+    network.loss_percent = LOSS_PERCENT;
+    network.compensate = false;
+    network.seed = rng();
+    sim_ntp_network(&network);
+
+    s->step_pending = 0;
+    s->syncs_seen = 0;
+    s->frame_syncs = 0;
+    s->sample_syncs = 0;
+    s->last_check = s->boot_us;
+    s->last_good_sync = -1;
+    s->bad_step = false;
+    s->stretch_shown = -1;
+
+    DisplayBus bus;
+    TM1637 disp(0, 2, CLOCK_TASK_DIGITS, &bus);
+    Tm1637Decoder decoder(0, 2);
+    decoder.SetOnUpdate(on_update, s);
+    disp.SetOnCommit(on_commit, s);
+
+    // Started as app_main does once WiFi is up, at a different point
+    // in the second each boot. Never freed, as the tasks are left
+    // blocked when the simulation is reset.
+    sim_run_until(CONNECT_US + rng_range(0, SECOND_US - 1));
+    Clock* clock = new Clock("pool.ntp.org");
+    s->clock = clock;
+    s->sync_base = clock->SyncCount();
+    Device* d = new Device();
+    d->display = &disp;
+    d->queue = xQueueCreate(10, sizeof(char[CLOCK_TASK_DIGITS]));
+    d->clock_task.clock = clock;
+    d->clock_task.queue = d->queue;
+    xTaskCreate(task_display, "display", 2048, d, 10, NULL);
+    xTaskCreate(task_clock, "clock", 2048, &d->clock_task, 10, NULL);
+
+    sim_schedule(sim_now_us() + SECOND_US, sample, s);
+    sim_run_until(duration);
+    check_syncs(s);
+    s->bus_errors += decoder.Errors();
+}
+
+int main(int argc, char** argv) {
+    int days = (argc > 1) ? atoi(argv[1]) : 4;
+    uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 0) : 1;
+
+    Soak s = Soak();
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    s.start_us = (DEFAULT_START + rng_range(0, 86399)) * SECOND_US;
+    s.outage_start = rng_interval(OUTAGE_EVERY_US);
+    s.outage_end = s.outage_start + rng_range(HOUR_US, MAX_OUTAGE_US);
+    s.next_bad_step = rng_interval(BAD_STEP_EVERY_US);
+    s.next_reboot = rng_interval(REBOOT_EVERY_US);
+
+    int64_t end = days * DAY_US;
+    auto started = std::chrono::steady_clock::now();
+
+    while (s.boot_us < end) {
+        int64_t until = (s.next_reboot < end) ? s.next_reboot : end;
+        boot(&s, until - s.boot_us);
+        s.boot_us = until;
+        if (until == s.next_reboot) {
+            s.reboots++;
+            s.next_reboot = until + rng_interval(REBOOT_EVERY_US);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started
+    ).count();
+
+    printf(
+        "%d days from %lld (seed %llu): %llu frames, %llu after time_t "
+        "wrapped, %d syncs, %d outages, %d bad steps, %d reboots\n",
+        days,
+        (long long)(s.start_us / SECOND_US),
+        (unsigned long long)seed,
+        (unsigned long long)s.frames,
+        (unsigned long long)s.frames_wrapped,
+        s.syncs,
+        s.outages,
+        s.bad_steps,
+        s.reboots
+    );
+    printf(
+        "minute changes shown in sync: %u, mean %lld us and max %lld us "
+        "after true time\n",
+        s.changes,
+        (long long)(s.changes ? s.total_late_us / s.changes : 0),
+        (long long)s.max_late_us
+    );
+    printf(
+        "display error from the device's clock: p99 %lld us, max %lld us\n",
+        (long long)s.device.PercentileUs(99),
+        (long long)s.device.MaxErrorUs()
+    );
+    printf(
+        "simulated %.0f s in %.2f s: %.2g simulated seconds per second\n",
+        (double)end / SECOND_US,
+        elapsed,
+        end / SECOND_US / elapsed
+    );
+
+    CHECK_EQ(s.bad_digit, 0);
+    CHECK_EQ(s.wrong_frame, 0);
+    CHECK_EQ(s.late_frame, 0);
+    CHECK_EQ(s.late_change, 0);
+    CHECK_EQ(s.wrong_fields, 0);
+    CHECK_EQ(s.wrong_us, 0);
+    CHECK_EQ(s.out_of_sync, 0);
+    CHECK_EQ(s.wrong_sync_record, 0);
+    CHECK_EQ(s.bus_errors, 0);
+
+    // Every second's write was seen, and the display was checked
+    // against true time for most of the run
+    CHECK(s.frames >= (uint64_t)(end / SECOND_US) * 9 / 10);
+    CHECK(s.changes >= (uint32_t)(end / (60 * SECOND_US)) / 2);
+    if (s.start_us + end > TIME_T_WRAP * SECOND_US) {
+        CHECK(s.frames_wrapped > 0);
+    }
+
+    return test_result("soak");
+}
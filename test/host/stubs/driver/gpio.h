@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name. Pin changes are
+// passed to listeners registered with the simulation.
+
+#ifndef STUBS_DRIVER_GPIO_H_
+#define STUBS_DRIVER_GPIO_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_MAX = 17,
+} gpio_num_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE = 0,
+} gpio_int_type_t;
+
+typedef enum {
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLDOWN_DISABLE = 0,
+} gpio_pulldown_t;
+
+typedef enum {
+    GPIO_PULLUP_DISABLE = 0,
+} gpio_pullup_t;
+
+typedef struct {
+    uint32_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t* config);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+
+#endif  // STUBS_DRIVER_GPIO_H_
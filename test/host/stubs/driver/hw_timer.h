@@ -0,0 +1,21 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name. The timer fires
+// from the simulation's virtual clock.
+
+#ifndef STUBS_DRIVER_HW_TIMER_H_
+#define STUBS_DRIVER_HW_TIMER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef void (*hw_timer_callback_t)(void* arg);
+
+esp_err_t hw_timer_init(hw_timer_callback_t callback, void* arg);
+esp_err_t hw_timer_deinit();
+esp_err_t hw_timer_alarm_us(uint32_t value, bool reload);
+esp_err_t hw_timer_disarm();
+
+#endif  // STUBS_DRIVER_HW_TIMER_H_
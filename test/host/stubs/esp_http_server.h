@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name. Requests are made
+// by tests through fakes/httpd.hpp.
+
+#ifndef STUBS_ESP_HTTP_SERVER_H_
+#define STUBS_ESP_HTTP_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+#define ESP_ERR_HTTPD_BASE 0x8000
+#define ESP_ERR_HTTPD_RESULT_TRUNC (ESP_ERR_HTTPD_BASE + 6)
+
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_INVALID -2
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+typedef void* httpd_handle_t;
+
+typedef enum {
+    HTTP_GET,
+    HTTP_POST,
+} httpd_method_t;
+
+typedef enum {
+    HTTPD_400_BAD_REQUEST,
+    HTTPD_404_NOT_FOUND,
+    HTTPD_500_INTERNAL_SERVER_ERROR,
+} httpd_err_code_t;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char* uri;
+    size_t content_len;
+    void* user_ctx;
+    // State of the fake request
+    void* aux;
+} httpd_req_t;
+
+typedef struct {
+    const char* uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t* req);
+    void* user_ctx;
+} httpd_uri_t;
+
+typedef struct {
+    unsigned task_priority;
+    size_t stack_size;
+    uint16_t server_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+    uint16_t backlog_conn;
+    bool lru_purge_enable;
+} httpd_config_t;
+
+httpd_config_t httpd_default_config();
+#define HTTPD_DEFAULT_CONFIG() httpd_default_config()
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config);
+esp_err_t httpd_register_uri_handler(
+    httpd_handle_t handle,
+    const httpd_uri_t* uri
+);
+
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t len);
+esp_err_t httpd_query_key_value(
+    const char* query,
+    const char* key,
+    char* value,
+    size_t len
+);
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type);
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len);
+esp_err_t httpd_resp_send_err(
+    httpd_req_t* req,
+    httpd_err_code_t error,
+    const char* message
+);
+
+#endif  // STUBS_ESP_HTTP_SERVER_H_
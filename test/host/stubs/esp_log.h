@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name. Logging is
+// compiled out so test output only shows results.
+
+#ifndef STUBS_ESP_LOG_H_
+#define STUBS_ESP_LOG_H_
+
+// Arguments are still evaluated so nothing is left unused
+static inline void esp_log_discard(const char* tag, ...) {
+}
+#define ESP_LOG_DISCARD(tag, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#define ESP_LOGE ESP_LOG_DISCARD
+#define ESP_LOGW ESP_LOG_DISCARD
+#define ESP_LOGI ESP_LOG_DISCARD
+#define ESP_LOGD ESP_LOG_DISCARD
+#define ESP_LOGV ESP_LOG_DISCARD
+
+#endif  // STUBS_ESP_LOG_H_
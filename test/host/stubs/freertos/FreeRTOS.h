@@ -0,0 +1,34 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name. Only one task
+// runs at a time on the host. Anything that would block hands over to
+// the simulation instead, see fakes/sim.hpp.
+
+#ifndef STUBS_FREERTOS_FREERTOS_H_
+#define STUBS_FREERTOS_FREERTOS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define portENTER_CRITICAL() do {} while (0)
+#define portEXIT_CRITICAL() do {} while (0)
+#define portEND_SWITCHING_ISR(woken) do { (void)(woken); } while (0)
+
+#endif  // STUBS_FREERTOS_FREERTOS_H_
@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name
+
+#ifndef STUBS_FREERTOS_QUEUE_H_
+#define STUBS_FREERTOS_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+typedef struct FakeQueue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout);
+
+// Receiving from an empty queue runs the simulation until an item is
+// sent or the timeout passes
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout);
+
+#endif  // STUBS_FREERTOS_QUEUE_H_
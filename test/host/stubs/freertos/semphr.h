@@ -0,0 +1,29 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name
+
+#ifndef STUBS_FREERTOS_SEMPHR_H_
+#define STUBS_FREERTOS_SEMPHR_H_
+
+#include "FreeRTOS.h"
+
+typedef struct FakeSemaphore* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting(
+    UBaseType_t max_count,
+    UBaseType_t initial_count
+);
+
+// Taking an empty semaphore runs the simulation until it is given or
+// the timeout passes
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(
+    SemaphoreHandle_t semaphore,
+    BaseType_t* higher_priority_task_woken
+);
+
+#endif  // STUBS_FREERTOS_SEMPHR_H_
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the SDK header of the same name
+
+#ifndef STUBS_FREERTOS_TASK_H_
+#define STUBS_FREERTOS_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef struct FakeTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* arg);
+
+TickType_t xTaskGetTickCount();
+
+// Delays run the simulation forward
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t* previous_wake, TickType_t increment);
+
+// Tasks take turns on their own threads, see fakes/sim.hpp
+BaseType_t xTaskCreate(
+    TaskFunction_t fn,
+    const char* name,
+    uint32_t stack_size,
+    void* arg,
+    UBaseType_t priority,
+    TaskHandle_t* handle
+);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken);
+
+#endif  // STUBS_FREERTOS_TASK_H_
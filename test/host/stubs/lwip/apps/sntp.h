@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. The client is
+// emulated by fakes/net.cpp.
+
+#ifndef STUBS_LWIP_APPS_SNTP_H_
+#define STUBS_LWIP_APPS_SNTP_H_
+
+#include <stdint.h>
+
+#include "lwip/ip_addr.h"
+
+#define SNTP_OPMODE_POLL 0
+
+void sntp_setoperatingmode(uint8_t mode);
+void sntp_setservername(uint8_t idx, const char* server);
+void sntp_init();
+void sntp_stop();
+uint32_t sntp_get_sync_interval();
+const ip_addr_t* sntp_getserver(uint8_t idx);
+
+#endif  // STUBS_LWIP_APPS_SNTP_H_
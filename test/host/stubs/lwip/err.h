@@ -0,0 +1,21 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name
+
+#ifndef STUBS_LWIP_ERR_H_
+#define STUBS_LWIP_ERR_H_
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_USE -8
+#define ERR_VAL -6
+
+#endif  // STUBS_LWIP_ERR_H_
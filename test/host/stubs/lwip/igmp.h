@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name
+
+#ifndef STUBS_LWIP_IGMP_H_
+#define STUBS_LWIP_IGMP_H_
+
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+err_t igmp_joingroup(const ip4_addr_t* if_addr, const ip4_addr_t* group);
+
+#endif  // STUBS_LWIP_IGMP_H_
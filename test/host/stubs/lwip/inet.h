@@ -0,0 +1,11 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name
+
+#ifndef STUBS_LWIP_INET_H_
+#define STUBS_LWIP_INET_H_
+
+#include <arpa/inet.h>
+
+#endif  // STUBS_LWIP_INET_H_
@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name
+
+#ifndef STUBS_LWIP_IP_H_
+#define STUBS_LWIP_IP_H_
+
+#include "lwip/netif.h"
+
+// Interface the packet being received came in on
+struct netif* ip_current_netif();
+
+#endif  // STUBS_LWIP_IP_H_
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. Addresses are
+// kept in network order as lwIP does.
+
+#ifndef STUBS_LWIP_IP_ADDR_H_
+#define STUBS_LWIP_IP_ADDR_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lwip/err.h"
+
+typedef struct {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+    union {
+        ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4 0
+
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
+#define IP4_ADDR_ANY4 (&ip_addr_any.u_addr.ip4)
+
+static inline void ip4_addr_set_bytes(
+    ip4_addr_t* ip,
+    uint8_t a,
+    uint8_t b,
+    uint8_t c,
+    uint8_t d
+) {
+    uint8_t bytes[4] = {a, b, c, d};
+    memcpy(&ip->addr, bytes, 4);
+}
+
+#define IP4_ADDR(ip, a, b, c, d) ip4_addr_set_bytes((ip), (a), (b), (c), (d))
+#define IP_ADDR4(ip, a, b, c, d) \
+    do { \
+        (ip)->type = IPADDR_TYPE_V4; \
+        IP4_ADDR(&(ip)->u_addr.ip4, (a), (b), (c), (d)); \
+    } while (0)
+
+#define IP_IS_V4(ip) ((ip)->type == IPADDR_TYPE_V4)
+#define ip_2_ip4(ip) (&(ip)->u_addr.ip4)
+#define ip4_addr_get_u32(ip) ((ip)->addr)
+#define ip4_addr_isany_val(ip) ((ip).addr == 0)
+
+#endif  // STUBS_LWIP_IP_ADDR_H_
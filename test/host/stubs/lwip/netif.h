@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. There is a
+// single interface whose address tests set through fakes/lwip.hpp.
+
+#ifndef STUBS_LWIP_NETIF_H_
+#define STUBS_LWIP_NETIF_H_
+
+#include "lwip/ip_addr.h"
+
+struct netif {
+    ip_addr_t ip_addr;
+};
+
+extern struct netif* netif_default;
+
+#define netif_ip4_addr(netif) (&(netif)->ip_addr.u_addr.ip4)
+
+#endif  // STUBS_LWIP_NETIF_H_
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. Packets are
+// always a single buffer.
+
+#ifndef STUBS_LWIP_PBUF_H_
+#define STUBS_LWIP_PBUF_H_
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+
+struct pbuf {
+    struct pbuf* next;
+    void* payload;
+    uint16_t tot_len;
+    uint16_t len;
+};
+
+typedef enum {
+    PBUF_TRANSPORT,
+    PBUF_RAW,
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_POOL,
+} pbuf_type;
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, uint16_t len, pbuf_type type);
+uint8_t pbuf_free(struct pbuf* p);
+err_t pbuf_take(struct pbuf* p, const void* data, uint16_t len);
+void pbuf_realloc(struct pbuf* p, uint16_t size);
+
+#endif  // STUBS_LWIP_PBUF_H_
@@ -0,0 +1,16 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. Callbacks run
+// from the simulation as if from the TCP/IP task.
+
+#ifndef STUBS_LWIP_TCPIP_H_
+#define STUBS_LWIP_TCPIP_H_
+
+#include "lwip/err.h"
+
+typedef void (*tcpip_callback_fn)(void* ctx);
+
+err_t tcpip_callback(tcpip_callback_fn function, void* ctx);
+
+#endif  // STUBS_LWIP_TCPIP_H_
@@ -0,0 +1,17 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. Timeouts run in
+// the emulated TCP/IP task.
+
+#ifndef STUBS_LWIP_TIMEOUTS_H_
+#define STUBS_LWIP_TIMEOUTS_H_
+
+#include <stdint.h>
+
+typedef void (*sys_timeout_handler)(void* arg);
+
+void sys_timeout(uint32_t ms, sys_timeout_handler handler, void* arg);
+void sys_untimeout(sys_timeout_handler handler, void* arg);
+
+#endif  // STUBS_LWIP_TIMEOUTS_H_
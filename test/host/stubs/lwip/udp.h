@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host stand in for the lwIP header of the same name. Datagrams are
+// exchanged with tests through fakes/lwip.hpp.
+
+#ifndef STUBS_LWIP_UDP_H_
+#define STUBS_LWIP_UDP_H_
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct udp_pcb;
+
+typedef void (*udp_recv_fn)(
+    void* arg,
+    struct udp_pcb* pcb,
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port
+);
+
+struct udp_pcb* udp_new();
+err_t udp_bind(struct udp_pcb* pcb, const ip_addr_t* addr, u16_t port);
+void udp_recv(struct udp_pcb* pcb, udp_recv_fn recv, void* arg);
+err_t udp_sendto(
+    struct udp_pcb* pcb,
+    struct pbuf* p,
+    const ip_addr_t* addr,
+    u16_t port
+);
+void udp_remove(struct udp_pcb* pcb);
+void udp_set_multicast_ttl(struct udp_pcb* pcb, uint8_t ttl);
+
+#endif  // STUBS_LWIP_UDP_H_
@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Project configuration used by the host build
+
+#ifndef STUBS_SDKCONFIG_H_
+#define STUBS_SDKCONFIG_H_
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_NTP_SERVER "pool.ntp.org"
+#define CONFIG_HTTP_API_PORT 80
+#define CONFIG_HTTP_API_MAX_CONNECTIONS 4
+
+#endif  // STUBS_SDKCONFIG_H_
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TEST_HOST_TEST_H_
+#define TEST_HOST_TEST_H_
+
+#include <cstdio>
+
+// Minimal checks for the host tests. Each test is its own executable
+// so the failure count can live in the header.
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long a_ = (long long)(a); \
+        long long b_ = (long long)(b); \
+        if (a_ != b_) { \
+            printf( \
+                "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, a_, b_ \
+            ); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// Print a summary and return the exit code for main()
+static inline int test_result(const char* name) {
+    if (test_failures == 0) {
+        printf("%s: passed\n", name);
+        return 0;
+    }
+    printf("%s: %d checks failed\n", name, test_failures);
+    return 1;
+}
+
+#endif  // TEST_HOST_TEST_H_
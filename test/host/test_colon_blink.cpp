@@ -0,0 +1,226 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for the colon blink. esp_timers fire from a 10ms tick as they
+// do on the device, and the display's pins are decoded by an emulated
+// TM1637 to check the colon is written once per edge, in phase with
+// the wall clock, and never from the timer callback itself. The blink
+// is also run from an event loop instead of its own task.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "colon_blink.hpp"
+#include "display_bus.hpp"
+#include "event_loop.hpp"
+#include "tm1637.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/tm1637_decoder.hpp"
+#include "test.hpp"
+
+#define HALF_SECOND_US 500000LL
+#define TICK_US 10000
+
+// Phase error allowed. The timer can fire up to two ticks early and the
+// write takes a few ms.
+#define MAX_ERROR_US 25000
+
+// Wall clock is the virtual clock plus an offset, which tests step to
+// emulate SNTP
+static int64_t wall_offset_us = 0;
+
+static int64_t wall_now_us() {
+    return sim_now_us() + wall_offset_us;
+}
+
+// A write seen on the display's pins
+struct Write {
+    int64_t wall_us;
+    bool colon;
+    int second;
+};
+
+static void on_update(Tm1637Decoder* decoder, void* arg) {
+    std::vector<Write>* writes = (std::vector<Write>*)arg;
+    Write w;
+    w.wall_us = wall_now_us();
+    w.colon = decoder->Colon();
+    w.second = decoder->Digit(4) * 10 + decoder->Digit(5);
+    writes->push_back(w);
+}
+
+static void render_seconds(int64_t us, char* frame, void* arg) {
+    int second = us / 1000000 % 60;
+    for (int i = 0; i < 4; i++) {
+        frame[i] = 0;
+    }
+    frame[4] = second / 10;
+    frame[5] = second % 10;
+}
+
+// Check each write is within MAX_ERROR_US of a half second edge and
+// shows the colon the right way round for it. Returns the edges
+// written, in order.
+static std::vector<int64_t> check_phase(const std::vector<Write>& writes) {
+    std::vector<int64_t> edges;
+    for (const Write& w : writes) {
+        int64_t edge = (w.wall_us + HALF_SECOND_US / 2) / HALF_SECOND_US;
+        int64_t error = w.wall_us - edge * HALF_SECOND_US;
+        CHECK(error > -MAX_ERROR_US && error < MAX_ERROR_US);
+        CHECK_EQ(w.colon, edge % 2 == 0);
+        edges.push_back(edge);
+    }
+    return edges;
+}
+
+static void test_once_per_edge() {
+    sim_reset();
+    sim_esp_timer_tick(TICK_US);
+    // Start out of phase with the tick
+    wall_offset_us = 1700000000LL * 1000000 + 123457;
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+    std::vector<Write> writes;
+    decoder.SetOnUpdate(on_update, &writes);
+
+    ColonBlink blink(&disp, wall_now_us);
+    blink.Start();
+    sim_run_until(600 * 1000000LL);
+
+    // Every edge is written exactly once
+    std::vector<int64_t> edges = check_phase(writes);
+    CHECK_EQ(edges.size(), 1200);
+    for (size_t i = 1; i < edges.size(); i++) {
+        CHECK_EQ(edges[i], edges[i - 1] + 1);
+    }
+    CHECK_EQ(decoder.Errors(), 0);
+
+    // The timer callback hands the write to the task without waiting
+    // for the bus
+    CHECK_EQ(sim_esp_timer_max_callback_us(), 0);
+    printf(
+        "phase error over 600s: mean %lld us, max %lld us\n",
+        (long long)blink.MeanErrorUs(),
+        (long long)blink.MaxErrorUs()
+    );
+    CHECK(blink.MaxErrorUs() < MAX_ERROR_US);
+}
+
+static void test_steps() {
+    sim_reset();
+    sim_esp_timer_tick(TICK_US);
+    wall_offset_us = 1700000000LL * 1000000;
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+    std::vector<Write> writes;
+    decoder.SetOnUpdate(on_update, &writes);
+
+    ColonBlink blink(&disp, wall_now_us);
+    blink.Start();
+    sim_run_until(10 * 1000000LL);
+
+    // Step forward part of a second, then back two hours. The timer
+    // already armed fires for the wrong edge, but the blink is back in
+    // phase by the edge after.
+    wall_offset_us += 300000;
+    sim_run_until(20 * 1000000LL);
+    wall_offset_us -= 2 * 3600 * 1000000LL;
+    sim_run_until(20 * 1000000LL + 1);
+    size_t from = writes.size();
+    sim_run_until(21 * 1000000LL);
+    // Skip the write for the edge the timer was armed for
+    writes.erase(writes.begin(), writes.begin() + from + 1);
+    size_t settled = writes.size();
+    sim_run_until(30 * 1000000LL);
+
+    std::vector<int64_t> edges = check_phase(writes);
+    CHECK(edges.size() - settled >= 17);
+    for (size_t i = 1; i < edges.size(); i++) {
+        CHECK_EQ(edges[i], edges[i - 1] + 1);
+    }
+}
+
+static void test_render() {
+    sim_reset();
+    sim_esp_timer_tick(TICK_US);
+    wall_offset_us = 1700000000LL * 1000000 + 777777;
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+    std::vector<Write> writes;
+    decoder.SetOnUpdate(on_update, &writes);
+
+    ColonBlink blink(&disp, wall_now_us);
+    blink.SetRender(render_seconds, NULL);
+    blink.Start();
+    sim_run_until(120 * 1000000LL);
+
+    // Each second's digits reach the display with the colon on the
+    // edge of that second. The colon's digit and the seconds are sent
+    // from separate addresses, so check what is shown after the last
+    // write for each edge.
+    std::vector<int64_t> edges = check_phase(writes);
+    int committed = 0;
+    for (size_t i = 0; i < writes.size(); i++) {
+        const Write& w = writes[i];
+        if (i + 1 < writes.size() && edges[i + 1] == edges[i]) {
+            continue;
+        }
+        if (w.colon) {
+            int second = (w.wall_us + HALF_SECOND_US) / 1000000 % 60;
+            if (committed > 0) {
+                CHECK_EQ(w.second, second);
+            }
+            committed++;
+        }
+    }
+    CHECK(committed >= 119);
+    CHECK_EQ(sim_esp_timer_max_callback_us(), 0);
+    CHECK_EQ(decoder.Errors(), 0);
+}
+
+static void test_event_loop() {
+    sim_reset();
+    sim_esp_timer_tick(TICK_US);
+    wall_offset_us = 1700000000LL * 1000000 + 123457;
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+    std::vector<Write> writes;
+    decoder.SetOnUpdate(on_update, &writes);
+
+    // Blinking from the loop starts no task or esp_timer of its own
+    EventLoop loop;
+    ColonBlink blink(&disp, wall_now_us);
+    blink.Start(&loop);
+    loop.Start("loop", 2048, 10);
+    sim_run_until(600 * 1000000LL);
+
+    // The loop wakes on the RTOS tick, so is later than the esp_timer
+    // but still writes every edge once
+    std::vector<int64_t> edges = check_phase(writes);
+    CHECK_EQ(edges.size(), 1200);
+    for (size_t i = 1; i < edges.size(); i++) {
+        CHECK_EQ(edges[i], edges[i - 1] + 1);
+    }
+    CHECK_EQ(sim_esp_timer_max_callback_us(), 0);
+    CHECK_EQ(decoder.Errors(), 0);
+    printf(
+        "phase error over 600s on the event loop: mean %lld us, "
+        "max %lld us\n",
+        (long long)blink.MeanErrorUs(),
+        (long long)blink.MaxErrorUs()
+    );
+    CHECK(blink.MaxErrorUs() < MAX_ERROR_US);
+}
+
+int main() {
+    test_once_per_edge();
+    test_steps();
+    test_render();
+    test_event_loop();
+    return test_result("colon_blink");
+}
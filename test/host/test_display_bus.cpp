@@ -0,0 +1,215 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Trace tests for the display bus. Two displays are attached on their
+// own pins and the pins are decoded by emulated TM1637s, to show that
+// transfers sent side by side arrive intact and don't disturb each
+// other.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "display_bus.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/tm1637_decoder.hpp"
+#include "test.hpp"
+
+#define START DISPLAY_BUS_OP_START
+#define BYTE(b) (DISPLAY_BUS_OP_BYTE | ((b) & 0xFF))
+#define STOP DISPLAY_BUS_OP_STOP
+
+// A full frame in the form the TM1637 driver sends it
+struct Frame {
+    uint16_t ops[DISPLAY_BUS_MAX_OPS];
+    int len;
+    std::vector<uint8_t> bytes;
+};
+
+static Frame make_frame(const uint8_t* segments, int digits, int brightness) {
+    Frame f;
+    f.len = 0;
+    f.ops[f.len++] = START;
+    f.ops[f.len++] = BYTE(0x40);
+    f.ops[f.len++] = STOP;
+    f.ops[f.len++] = START;
+    f.ops[f.len++] = BYTE(0xC0);
+    for (int i = 0; i < digits; i++) {
+        f.ops[f.len++] = BYTE(segments[i]);
+    }
+    f.ops[f.len++] = STOP;
+    f.ops[f.len++] = START;
+    f.ops[f.len++] = BYTE(0x88 | brightness);
+    f.ops[f.len++] = STOP;
+
+    f.bytes.push_back(0x40);
+    f.bytes.push_back(0xC0);
+    f.bytes.insert(f.bytes.end(), segments, segments + digits);
+    f.bytes.push_back(0x88 | brightness);
+    return f;
+}
+
+static const uint8_t face_a[6] = {0x3F, 0x86, 0x5B, 0x4F, 0x66, 0x6D};
+static const uint8_t face_b[6] = {0x7D, 0x07, 0x7F, 0x6F, 0x77, 0x7C};
+
+// Counts pin changes, to check a display's pins are left alone
+struct PinCounter {
+    int pins[2];
+    int changes = 0;
+};
+
+static void count_pins(int pin, int level, void* arg) {
+    PinCounter* c = (PinCounter*)arg;
+    if (pin == c->pins[0] || pin == c->pins[1]) {
+        c->changes++;
+    }
+}
+
+// Send one frame on one display alone and return how many timer ticks
+// it took
+static uint64_t single_display_ticks() {
+    sim_reset();
+    DisplayBus bus;
+    int ch = bus.Attach(GPIO_NUM_0, (gpio_num_t)2);
+    Tm1637Decoder decoder(0, 2);
+    Frame frame = make_frame(face_a, 6, 7);
+
+    int slot = bus.Submit(ch, frame.ops, frame.len, 0);
+    CHECK(bus.Wait(ch, slot, pdMS_TO_TICKS(200)));
+    CHECK(decoder.Bytes() == frame.bytes);
+    CHECK_EQ(decoder.Errors(), 0);
+    return sim_hw_timer_fires();
+}
+
+static void test_side_by_side() {
+    uint64_t single = single_display_ticks();
+
+    sim_reset();
+    DisplayBus bus;
+    int ch_a = bus.Attach(GPIO_NUM_0, (gpio_num_t)2);
+    int ch_b = bus.Attach((gpio_num_t)4, (gpio_num_t)5);
+    Tm1637Decoder a(0, 2);
+    Tm1637Decoder b(4, 5);
+    Frame frame_a = make_frame(face_a, 6, 7);
+    Frame frame_b = make_frame(face_b, 4, 2);
+
+    int slot_a = bus.Submit(ch_a, frame_a.ops, frame_a.len, 0);
+    int slot_b = bus.Submit(ch_b, frame_b.ops, frame_b.len, 0);
+    CHECK(bus.Wait(ch_a, slot_a, pdMS_TO_TICKS(200)));
+    CHECK(bus.Wait(ch_b, slot_b, pdMS_TO_TICKS(200)));
+
+    CHECK(a.Bytes() == frame_a.bytes);
+    CHECK(b.Bytes() == frame_b.bytes);
+    CHECK_EQ(a.Errors(), 0);
+    CHECK_EQ(b.Errors(), 0);
+    CHECK_EQ(a.Digit(0), 0);
+    CHECK(a.Colon());
+    CHECK_EQ(b.Digit(3), 9);
+    CHECK_EQ(b.Brightness(), 2);
+
+    // Both displays are updated in the time it takes to update one
+    CHECK_EQ(sim_hw_timer_fires(), single);
+    printf(
+        "one display: %llu ticks, two displays: %llu ticks\n",
+        (unsigned long long)single,
+        (unsigned long long)sim_hw_timer_fires()
+    );
+}
+
+// Submits a frame on a display part way through another's transfer
+struct LateSubmit {
+    DisplayBus* bus;
+    int channel;
+    Frame* frame;
+    int slot;
+};
+
+static void submit_late(void* arg) {
+    LateSubmit* s = (LateSubmit*)arg;
+    s->slot = s->bus->Submit(s->channel, s->frame->ops, s->frame->len, 0);
+}
+
+static void test_staggered() {
+    // Start at every offset through the first display's transfer, with
+    // interrupts held off by up to 40us as they would be under WiFi
+    // load
+    for (int offset_us = 0; offset_us < 12000; offset_us += 173) {
+        sim_reset();
+        sim_hw_timer_jitter(40, offset_us);
+        DisplayBus bus;
+        int ch_a = bus.Attach(GPIO_NUM_0, (gpio_num_t)2);
+        int ch_b = bus.Attach((gpio_num_t)4, (gpio_num_t)5);
+        Tm1637Decoder a(0, 2);
+        Tm1637Decoder b(4, 5);
+        Frame frame_a = make_frame(face_a, 6, 7);
+        Frame frame_b = make_frame(face_b, 6, 3);
+
+        LateSubmit late = {&bus, ch_b, &frame_b, -1};
+        sim_schedule(offset_us, submit_late, &late);
+
+        int slot_a = bus.Submit(ch_a, frame_a.ops, frame_a.len, 0);
+        // A second frame queued behind the first on the same display
+        int slot_a2 = bus.Submit(ch_a, frame_b.ops, frame_b.len, 0);
+        CHECK(bus.Wait(ch_a, slot_a, pdMS_TO_TICKS(200)));
+        CHECK(bus.Wait(ch_a, slot_a2, pdMS_TO_TICKS(200)));
+        sim_run_until(offset_us);
+        CHECK(late.slot >= 0);
+        CHECK(bus.Wait(ch_b, late.slot, pdMS_TO_TICKS(200)));
+
+        std::vector<uint8_t> expect_a = frame_a.bytes;
+        expect_a.insert(expect_a.end(), frame_b.bytes.begin(), frame_b.bytes.end());
+        CHECK(a.Bytes() == expect_a);
+        CHECK(b.Bytes() == frame_b.bytes);
+        CHECK_EQ(a.Errors(), 0);
+        CHECK_EQ(b.Errors(), 0);
+        CHECK_EQ(a.Starts(), 6);
+        CHECK_EQ(b.Starts(), 3);
+    }
+}
+
+static void test_idle_pins_untouched() {
+    sim_reset();
+    DisplayBus bus;
+    int ch_a = bus.Attach(GPIO_NUM_0, (gpio_num_t)2);
+    bus.Attach((gpio_num_t)4, (gpio_num_t)5);
+    PinCounter counter;
+    counter.pins[0] = 4;
+    counter.pins[1] = 5;
+    sim_gpio_listen(count_pins, &counter);
+
+    Frame frame = make_frame(face_a, 6, 7);
+    int slot = bus.Submit(ch_a, frame.ops, frame.len, 0);
+    CHECK(bus.Wait(ch_a, slot, pdMS_TO_TICKS(200)));
+    CHECK_EQ(counter.changes, 0);
+
+    // The timer stops once there is nothing left to send
+    uint64_t fires = sim_hw_timer_fires();
+    sim_run_until(sim_now_us() + 1000000);
+    CHECK_EQ(sim_hw_timer_fires(), fires);
+}
+
+static void test_queue_full() {
+    sim_reset();
+    DisplayBus bus;
+    int ch = bus.Attach(GPIO_NUM_0, (gpio_num_t)2);
+    Frame frame = make_frame(face_a, 6, 7);
+
+    int first = bus.Submit(ch, frame.ops, frame.len, 0);
+    int second = bus.Submit(ch, frame.ops, frame.len, 0);
+    CHECK(first >= 0);
+    CHECK(second >= 0);
+    CHECK_EQ(bus.Submit(ch, frame.ops, frame.len, 0), -1);
+
+    // Waiting for room lets the queue drain
+    int third = bus.Submit(ch, frame.ops, frame.len, pdMS_TO_TICKS(200));
+    CHECK(third >= 0);
+    CHECK(bus.Wait(ch, third, pdMS_TO_TICKS(200)));
+}
+
+int main() {
+    test_side_by_side();
+    test_staggered();
+    test_idle_pins_untouched();
+    test_queue_full();
+    return test_result("display_bus");
+}
@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for the event loop on the simulated RTOS tick. Checks periodic
+// timers keep their cadence when the loop is started long after it was
+// created, and when a callback overruns into the ticks after it.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "event_loop.hpp"
+#include "fakes/sim.hpp"
+#include "test.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define MS_US 1000LL
+#define SECOND_US 1000000LL
+
+// Virtual times a timer ran at
+struct Runs {
+    std::vector<int64_t> at;
+
+    // Time to block for each run, emulating a slow callback
+    uint32_t block_ms = 0;
+};
+
+static void record_run(void* arg) {
+    Runs* r = (Runs*)arg;
+    r->at.push_back(sim_now_us());
+    if (r->block_ms > 0) {
+        vTaskDelay(r->block_ms / portTICK_PERIOD_MS);
+    }
+}
+
+static void test_late_start() {
+    sim_reset();
+    EventLoop loop;
+    Runs every_second;
+    Runs once;
+    Timer periodic(record_run, &every_second);
+    Timer one_shot(record_run, &once);
+
+    // Scheduled when the loop is created, as main.cpp does, but only
+    // started after waiting five seconds for WiFi
+    loop.Schedule(&periodic, 1000, 1000);
+    loop.Schedule(&one_shot, 2500);
+    sim_run_until(5 * SECOND_US);
+    loop.Start("loop", 2048, 10);
+    sim_run_until(15 * SECOND_US + 1);
+
+    // Delays count from the start, then the timer runs once a second
+    // with no catching up on the time before
+    CHECK_EQ(every_second.at.size(), 10);
+    for (size_t i = 0; i < every_second.at.size(); i++) {
+        CHECK_EQ(every_second.at[i], (6 + (int64_t)i) * SECOND_US);
+    }
+    CHECK_EQ(once.at.size(), 1);
+    CHECK_EQ(once.at[0], 7500 * MS_US);
+}
+
+static void test_overrun() {
+    sim_reset();
+    EventLoop loop;
+    Runs fast;
+    Runs slow;
+    slow.block_ms = 260;
+    Timer fast_timer(record_run, &fast);
+    Timer slow_timer(record_run, &slow);
+
+    loop.Schedule(&fast_timer, 100, 100);
+    loop.Schedule(&slow_timer, 1050, 1000);
+    loop.Start("loop", 2048, 10);
+    sim_run_until(10 * SECOND_US);
+
+    // The slow timer keeps to its period despite taking over a quarter
+    // of it
+    CHECK_EQ(slow.at.size(), 9);
+    for (size_t i = 0; i < slow.at.size(); i++) {
+        CHECK_EQ(slow.at[i], 1050 * MS_US + (int64_t)i * SECOND_US);
+    }
+
+    // The fast timer is held up by each overrun, which ends 310ms into
+    // the second. It runs once as soon as the slow callback returns,
+    // not once for each of the three periods it missed, and then is
+    // back on its 100ms grid.
+    int late = 0;
+    for (size_t i = 0; i < fast.at.size(); i++) {
+        int64_t t = fast.at[i];
+        if (i > 0) {
+            CHECK(t > fast.at[i - 1]);
+        }
+        if (t % (100 * MS_US) != 0) {
+            late++;
+            CHECK_EQ(t % SECOND_US, 310 * MS_US);
+            CHECK(i + 1 < fast.at.size());
+            CHECK_EQ(fast.at[i + 1], t + 90 * MS_US);
+        }
+    }
+    CHECK_EQ(late, 9);
+    CHECK_EQ(fast.at.size(), 100 - 9 * 3 + late);
+}
+
+int main() {
+    test_late_start();
+    test_overrun();
+    return test_result("event_loop");
+}
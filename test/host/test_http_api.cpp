@@ -0,0 +1,372 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Load test for the HTTP API. A generator makes a mix of requests to
+// every endpoint, including settings that try to break out of the JSON
+// they are echoed in, and checks every response. Latency is measured on
+// the host and allocations are counted by wrapping malloc, so the
+// figures describe the handlers rather than the device's network stack.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#include "http_api.hpp"
+#include "settings.hpp"
+#include "fakes/httpd.hpp"
+#include "fakes/sim.hpp"
+#include "test.hpp"
+
+#define REQUESTS 20000
+
+// Allocations made while counting is on. The test binary is linked with
+// --wrap for the malloc family, which catches calls from the firmware
+// sources. operator new is replaced outright.
+static bool counting = false;
+static long allocations = 0;
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_calloc(size_t n, size_t size);
+extern "C" void* __real_realloc(void* ptr, size_t size);
+
+extern "C" void* __wrap_malloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_malloc(size);
+}
+
+extern "C" void* __wrap_calloc(size_t n, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_calloc(n, size);
+}
+
+extern "C" void* __wrap_realloc(void* ptr, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_realloc(ptr, size);
+}
+
+void* operator new(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    void* ptr = __real_malloc(size);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+// Minimal JSON syntax check. Returns the position after the value or
+// NULL if it isn't valid.
+static const char* json_value(const char* p);
+
+static const char* json_string(const char* p) {
+    if (*p++ != '"') {
+        return NULL;
+    }
+    while (*p != '"') {
+        if (*p == '\0' || (unsigned char)*p < 0x20) {
+            return NULL;
+        }
+        if (*p == '\\') {
+            p++;
+            if (strchr("\"\\/bfnrt", *p) == NULL || *p == '\0') {
+                return NULL;
+            }
+        }
+        p++;
+    }
+    return p + 1;
+}
+
+static const char* json_number(const char* p) {
+    if (*p == '-') {
+        p++;
+    }
+    if (*p < '0' || *p > '9') {
+        return NULL;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    return p;
+}
+
+static const char* json_object(const char* p) {
+    p++;
+    if (*p == '}') {
+        return p + 1;
+    }
+    while (true) {
+        p = json_string(p);
+        if (p == NULL || *p++ != ':') {
+            return NULL;
+        }
+        p = json_value(p);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (*p == '}') {
+            return p + 1;
+        }
+        if (*p++ != ',') {
+            return NULL;
+        }
+    }
+}
+
+static const char* json_array(const char* p) {
+    p++;
+    if (*p == ']') {
+        return p + 1;
+    }
+    while (true) {
+        p = json_value(p);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (*p == ']') {
+            return p + 1;
+        }
+        if (*p++ != ',') {
+            return NULL;
+        }
+    }
+}
+
+static const char* json_value(const char* p) {
+    switch (*p) {
+    case '{':
+        return json_object(p);
+    case '[':
+        return json_array(p);
+    case '"':
+        return json_string(p);
+    case 't':
+        return strncmp(p, "true", 4) == 0 ? p + 4 : NULL;
+    case 'f':
+        return strncmp(p, "false", 5) == 0 ? p + 5 : NULL;
+    case 'n':
+        return strncmp(p, "null", 4) == 0 ? p + 4 : NULL;
+    default:
+        return json_number(p);
+    }
+}
+
+static bool valid_json(const char* s) {
+    const char* end = json_value(s);
+    return end != NULL && *end == '\0';
+}
+
+// Server names that are accepted
+static const char* const good_servers[] = {
+    "pool.ntp.org",
+    "time.google.com",
+    "192.168.1.1",
+    "ntp-1.example",
+    "a.b",
+};
+
+// Server names that must be rejected. The last is 64 characters, one
+// more than fits.
+static const char* const bad_servers[] = {
+    "a\"b",
+    "x\\y",
+    "x\",\"synced\":true,\"y\":\"",
+    "-a.com",
+    "a-.com",
+    "a..b",
+    ".a",
+    "a.",
+    "%22",
+    "a b",
+    "",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+};
+
+#define NUM_GOOD (sizeof(good_servers) / sizeof(good_servers[0]))
+#define NUM_BAD (sizeof(bad_servers) / sizeof(bad_servers[0]))
+
+static const char* const get_uris[] = {
+    "/api/status",
+    "/api/sync",
+    "/api/accuracy",
+    "/api/boot",
+    "/api/settings",
+    "/api/brightness",
+};
+
+#define NUM_GETS (sizeof(get_uris) / sizeof(get_uris[0]))
+
+// A request and what it should get back
+struct Request {
+    httpd_method_t method;
+    const char* uri;
+    char body[128];
+    size_t chunk;
+    int status;
+    // Server that should be set after the request, if any
+    const char* server;
+};
+
+static void make_request(int i, Request* r) {
+    r->chunk = 1 + i % 16;
+    r->body[0] = '\0';
+    r->server = NULL;
+    r->status = 200;
+
+    switch (i % 10) {
+    case 0:
+        r->method = HTTP_POST;
+        r->uri = "/api/settings";
+        r->server = good_servers[i / 10 % NUM_GOOD];
+        snprintf(r->body, sizeof(r->body), "ntp_server=%s", r->server);
+        break;
+    case 1:
+    case 2: {
+        const char* server = bad_servers[i / 10 % NUM_BAD];
+        r->method = HTTP_POST;
+        r->uri = "/api/settings";
+        r->status = 400;
+        if (i % 10 == 1) {
+            snprintf(r->body, sizeof(r->body), "ntp_server=%s", server);
+        }
+        else {
+            // Padding after the name, or a body too big to accept
+            snprintf(
+                r->body, sizeof(r->body), "ntp_server=%s&pad=%0*d",
+                server, (int)(i / 10 % 100), 0
+            );
+        }
+        break;
+    }
+    case 3:
+        r->method = HTTP_POST;
+        r->uri = "/api/brightness";
+        snprintf(r->body, sizeof(r->body), "level=%d", i / 10 % 8);
+        break;
+    default:
+        r->method = HTTP_GET;
+        r->uri = get_uris[i % NUM_GETS];
+        break;
+    }
+}
+
+// A clock given a name it can't use still starts SNTP, with the default
+static void test_invalid_server() {
+    sim_reset();
+    Clock clock("bad\"name");
+    sim_run_until(1000);
+    CHECK(sim_sntp_running());
+    CHECK(strcmp(sim_sntp_server(), Clock::kDefaultServer) == 0);
+    char server[Clock::kMaxServerLen + 1];
+    clock.Server(server);
+    CHECK(strcmp(server, Clock::kDefaultServer) == 0);
+    CHECK_EQ(sim_sntp_misuse(), 0);
+}
+
+int main() {
+    test_invalid_server();
+
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 4, &bus);
+    DisplayAccuracy accuracy;
+    Clock clock(get_ntp_server());
+    CHECK_EQ(http_api_start(&clock, &disp, NULL, &accuracy), ESP_OK);
+    sim_run_until(1000);
+    CHECK(sim_sntp_running());
+    CHECK(strcmp(sim_sntp_server(), "pool.ntp.org") == 0);
+
+    std::vector<int64_t> latency;
+    latency.reserve(REQUESTS);
+    Request r;
+    SimHttpResponse response;
+    const char* server = "pool.ntp.org";
+    char current[Clock::kMaxServerLen + 1];
+    int rejected = 0;
+    long heap_allocations = 0;
+
+    for (int i = 0; i < REQUESTS; i++) {
+        make_request(i, &r);
+
+        counting = true;
+        auto start = std::chrono::steady_clock::now();
+        bool found = sim_http_request(
+            r.method, r.uri, r.body, r.chunk, &response
+        );
+        auto end = std::chrono::steady_clock::now();
+        // Let the TCP/IP task restart SNTP
+        sim_run_until(sim_now_us() + 10000);
+        counting = false;
+
+        heap_allocations += allocations;
+        allocations = 0;
+        latency.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                end - start
+            ).count()
+        );
+
+        CHECK(found);
+        CHECK_EQ(response.status, r.status);
+        if (response.status == 200) {
+            CHECK(strcmp(response.type, "application/json") == 0);
+            CHECK(valid_json(response.body));
+        }
+        else {
+            rejected++;
+        }
+
+        if (r.server != NULL) {
+            server = r.server;
+        }
+        clock.Server(current);
+        CHECK(strcmp(current, server) == 0);
+        CHECK(strcmp(get_ntp_server(), server) == 0);
+        CHECK(strcmp(sim_sntp_server(), server) == 0);
+    }
+
+    // SNTP was only touched from the TCP/IP task while stopped, and holds
+    // a name that nothing else writes to
+    CHECK(sim_sntp_running());
+    CHECK_EQ(sim_sntp_misuse(), 0);
+    CHECK_EQ(sim_sntp_starts(), 1 + (REQUESTS + 9) / 10);
+    CHECK(sim_sntp_server() != get_ntp_server());
+
+    // Every response, including status with the stored server, is
+    // still valid JSON
+    sim_http_request(HTTP_GET, "/api/sync", NULL, 1, &response);
+    CHECK(valid_json(response.body));
+    CHECK(strstr(response.body, server) != NULL);
+
+    std::sort(latency.begin(), latency.end());
+    printf(
+        "%d requests, %d rejected: host latency p50 %lld ns, "
+        "p99 %lld ns, max %lld ns\n",
+        REQUESTS,
+        rejected,
+        (long long)latency[REQUESTS / 2],
+        (long long)latency[REQUESTS * 99 / 100],
+        (long long)latency[REQUESTS - 1]
+    );
+    printf("heap allocations while serving: %ld\n", heap_allocations);
+    CHECK_EQ(heap_allocations, 0);
+    CHECK_EQ(rejected, REQUESTS / 10 * 2);
+
+    return test_result("http_api");
+}
@@ -0,0 +1,607 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for the mDNS responder. A querier sends queries through the
+// emulated lwIP UDP layer and decodes every response with its own
+// parser, following compression pointers, so anything a real resolver
+// would choke on fails here.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+#include <vector>
+
+#include "mdns_responder.hpp"
+#include "fakes/lwip.hpp"
+#include "fakes/sim.hpp"
+#include "test.hpp"
+
+#define MDNS_PORT 5353
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define TYPE_TXT 16
+#define TYPE_SRV 33
+#define TYPE_ANY 255
+#define CLASS_IN 1
+#define CACHE_FLUSH 0x8000
+#define UNICAST_RESPONSE 0x8000
+
+#define BUFFER_SIZE 512
+
+struct Record {
+    std::string name;
+    int type;
+    int rclass;
+    uint32_t ttl;
+    // PTR and SRV target
+    std::string target;
+    uint16_t port;
+    std::string txt;
+    uint8_t a[4];
+};
+
+struct Message {
+    uint16_t id;
+    uint16_t flags;
+    std::vector<std::string> questions;
+    std::vector<Record> answers;
+    std::vector<Record> additional;
+    // Length of the message if no names were compressed
+    int expanded_len;
+};
+
+// A response as it went out
+struct Sent {
+    std::vector<uint8_t> data;
+    uint8_t addr[4];
+    uint16_t port;
+};
+
+static void on_send(
+    const uint8_t* data,
+    int len,
+    const ip_addr_t* addr,
+    uint16_t port,
+    void* arg
+) {
+    std::vector<Sent>* sent = (std::vector<Sent>*)arg;
+    Sent s;
+    s.data.assign(data, data + len);
+    memcpy(s.addr, &addr->u_addr.ip4.addr, 4);
+    s.port = port;
+    sent->push_back(s);
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Read a name at *offset. Pointers must point back to an earlier
+// label, as RFC 1035 requires. Adds the number of bytes the name would
+// take uncompressed to *expanded.
+static bool read_name(
+    const std::vector<uint8_t>& msg,
+    int* offset,
+    std::string* name,
+    int* expanded
+) {
+    int pos = *offset;
+    bool jumped = false;
+    name->clear();
+
+    while (true) {
+        if (pos >= (int)msg.size()) {
+            return false;
+        }
+        uint8_t len = msg[pos];
+        if ((len & 0xC0) == 0xC0) {
+            if (pos + 1 >= (int)msg.size()) {
+                return false;
+            }
+            int target = ((len & 0x3F) << 8) | msg[pos + 1];
+            if (target >= pos) {
+                return false;
+            }
+            if (!jumped) {
+                *offset = pos + 2;
+                jumped = true;
+            }
+            pos = target;
+            continue;
+        }
+        if ((len & 0xC0) != 0 || pos + 1 + len > (int)msg.size()) {
+            return false;
+        }
+        *expanded += 1 + len;
+        if (len == 0) {
+            if (!jumped) {
+                *offset = pos + 1;
+            }
+            return true;
+        }
+        if (!name->empty()) {
+            *name += '.';
+        }
+        name->append((const char*)&msg[pos + 1], len);
+        pos += 1 + len;
+    }
+}
+
+static bool read_record(
+    const std::vector<uint8_t>& msg,
+    int* offset,
+    Record* r,
+    int* expanded
+) {
+    int start = *offset;
+    if (!read_name(msg, offset, &r->name, expanded)) {
+        return false;
+    }
+    int pos = *offset;
+    if (pos + 10 > (int)msg.size()) {
+        return false;
+    }
+    const uint8_t* p = &msg[pos];
+    r->type = get16(p);
+    r->rclass = get16(p + 2);
+    r->ttl = ((uint32_t)get16(p + 4) << 16) | get16(p + 6);
+    int rdlength = get16(p + 8);
+    pos += 10;
+    int end = pos + rdlength;
+    if (end > (int)msg.size()) {
+        return false;
+    }
+    *expanded += 10;
+
+    // Names in the data may be compressed too, and must use up exactly
+    // the data length
+    int data_expanded = 0;
+    switch (r->type) {
+    case TYPE_A:
+        if (rdlength != 4) {
+            return false;
+        }
+        memcpy(r->a, &msg[pos], 4);
+        data_expanded = 4;
+        break;
+    case TYPE_PTR:
+        if (!read_name(msg, &pos, &r->target, &data_expanded)) {
+            return false;
+        }
+        break;
+    case TYPE_SRV:
+        if (rdlength < 7) {
+            return false;
+        }
+        r->port = get16(&msg[pos + 4]);
+        pos += 6;
+        data_expanded = 6;
+        if (!read_name(msg, &pos, &r->target, &data_expanded)) {
+            return false;
+        }
+        break;
+    case TYPE_TXT:
+        if (rdlength < 1 || msg[pos] + 1 != rdlength) {
+            return false;
+        }
+        r->txt.assign((const char*)&msg[pos + 1], msg[pos]);
+        data_expanded = rdlength;
+        break;
+    default:
+        return false;
+    }
+    if (r->type != TYPE_A && r->type != TYPE_TXT && pos != end) {
+        return false;
+    }
+    *expanded += data_expanded;
+    *offset = end;
+    return *offset > start;
+}
+
+static bool decode(const std::vector<uint8_t>& msg, Message* m) {
+    if (msg.size() < 12) {
+        return false;
+    }
+    m->id = get16(&msg[0]);
+    m->flags = get16(&msg[2]);
+    int questions = get16(&msg[4]);
+    int answers = get16(&msg[6]);
+    int authority = get16(&msg[8]);
+    int additional = get16(&msg[10]);
+    if (authority != 0) {
+        return false;
+    }
+
+    int offset = 12;
+    m->expanded_len = 12;
+    m->questions.clear();
+    m->answers.clear();
+    m->additional.clear();
+    for (int i = 0; i < questions; i++) {
+        std::string name;
+        if (!read_name(msg, &offset, &name, &m->expanded_len)) {
+            return false;
+        }
+        offset += 4;
+        m->expanded_len += 4;
+        m->questions.push_back(name);
+    }
+    for (int i = 0; i < answers + additional; i++) {
+        Record r;
+        if (!read_record(msg, &offset, &r, &m->expanded_len)) {
+            return false;
+        }
+        (i < answers ? m->answers : m->additional).push_back(r);
+    }
+    return offset == (int)msg.size();
+}
+
+// Append a question. A name of the form "label@offset" is written as
+// the label followed by a pointer to offset.
+static void put_question(
+    std::vector<uint8_t>* q,
+    const char* name,
+    uint16_t type,
+    uint16_t qclass
+) {
+    const char* at = strchr(name, '@');
+    const char* end = (at != NULL) ? at : name + strlen(name);
+    const char* p = name;
+    while (p < end) {
+        const char* dot = (const char*)memchr(p, '.', end - p);
+        int len = (dot != NULL) ? dot - p : end - p;
+        q->push_back(len);
+        q->insert(q->end(), p, p + len);
+        p += len + (dot != NULL ? 1 : 0);
+    }
+    if (at != NULL) {
+        int target = atoi(at + 1);
+        q->push_back(0xC0 | (target >> 8));
+        q->push_back(target & 0xFF);
+    }
+    else {
+        q->push_back(0);
+    }
+    q->push_back(type >> 8);
+    q->push_back(type & 0xFF);
+    q->push_back(qclass >> 8);
+    q->push_back(qclass & 0xFF);
+}
+
+static std::vector<uint8_t> query_header(uint16_t id, int questions) {
+    std::vector<uint8_t> q = {
+        (uint8_t)(id >> 8), (uint8_t)id, 0, 0,
+        0, (uint8_t)questions, 0, 0, 0, 0, 0, 0
+    };
+    return q;
+}
+
+static std::vector<uint8_t> query(
+    const char* name,
+    uint16_t type,
+    uint16_t qclass = CLASS_IN
+) {
+    std::vector<uint8_t> q = query_header(0, 1);
+    put_question(&q, name, type, qclass);
+    return q;
+}
+
+// Send a query and run the TCP/IP task until it has been answered
+static void ask(
+    const std::vector<uint8_t>& q,
+    uint16_t from_port = MDNS_PORT
+) {
+    ip_addr_t from;
+    IP_ADDR4(&from, 192, 168, 1, 10);
+    sim_udp_deliver(MDNS_PORT, q.data(), q.size(), &from, from_port);
+    sim_run_until(sim_now_us() + 10000);
+}
+
+static bool is_group(const Sent& s) {
+    static const uint8_t group[4] = {224, 0, 0, 251};
+    return memcmp(s.addr, group, 4) == 0 && s.port == MDNS_PORT;
+}
+
+static int count_type(const std::vector<Record>& records, int type) {
+    int count = 0;
+    for (const Record& r : records) {
+        count += r.type == type;
+    }
+    return count;
+}
+
+static void test_announcement() {
+    sim_reset();
+    sim_netif_set_ip(192, 168, 1, 50);
+    std::vector<Sent> sent;
+    sim_udp_listen(on_send, &sent);
+
+    MdnsResponder mdns("networkclock", "Network Clock");
+    CHECK(mdns.AddService("_http", "_tcp", 80, "path=/api"));
+    CHECK(mdns.AddService("_ntp", "_udp", 123));
+    mdns.Start();
+    sim_run_until(5 * 1000000LL);
+    CHECK_EQ(sim_igmp_groups(), 1);
+
+    // Announced twice, a second apart
+    CHECK_EQ(sent.size(), 2);
+    for (const Sent& s : sent) {
+        CHECK(is_group(s));
+        Message m;
+        CHECK(decode(s.data, &m));
+        CHECK_EQ(m.flags, 0x8400);
+        CHECK_EQ(m.answers.size(), 9);
+        CHECK_EQ(count_type(m.answers, TYPE_A), 1);
+        CHECK_EQ(count_type(m.answers, TYPE_PTR), 4);
+        CHECK_EQ(count_type(m.answers, TYPE_SRV), 2);
+        CHECK_EQ(count_type(m.answers, TYPE_TXT), 2);
+        for (const Record& r : m.answers) {
+            if (r.type == TYPE_A) {
+                CHECK(r.name == "networkclock.local");
+                CHECK_EQ(r.a[0], 192);
+                CHECK_EQ(r.a[3], 50);
+                CHECK_EQ(r.rclass, CLASS_IN | CACHE_FLUSH);
+            }
+            if (r.type == TYPE_SRV) {
+                CHECK(r.target == "networkclock.local");
+                bool http = r.name == "Network Clock._http._tcp.local";
+                bool ntp = r.name == "Network Clock._ntp._udp.local";
+                CHECK(http || ntp);
+                CHECK_EQ(r.port, http ? 80 : 123);
+            }
+            if (r.type == TYPE_TXT) {
+                bool http = r.name == "Network Clock._http._tcp.local";
+                CHECK(r.txt == (http ? "path=/api" : ""));
+            }
+            if (r.type == TYPE_PTR && r.name == "_http._tcp.local") {
+                CHECK(r.target == "Network Clock._http._tcp.local");
+            }
+        }
+    }
+    Message m;
+    decode(sent[0].data, &m);
+    printf(
+        "announcement with 2 services: %d bytes, %d uncompressed\n",
+        (int)sent[0].data.size(),
+        m.expanded_len
+    );
+}
+
+// The address in the A record of an announcement
+static int announced_host(const Sent& s) {
+    Message m;
+    CHECK(decode(s.data, &m));
+    for (const Record& r : m.answers) {
+        if (r.type == TYPE_A) {
+            return r.a[3];
+        }
+    }
+    return -1;
+}
+
+static void test_reannounce() {
+    sim_reset();
+    sim_netif_set_ip(192, 168, 1, 50);
+    std::vector<Sent> sent;
+    sim_udp_listen(on_send, &sent);
+
+    MdnsResponder mdns("networkclock", "Network Clock");
+    mdns.Start();
+    sim_run_until(500000);
+    CHECK_EQ(sent.size(), 1);
+
+    // A new address half way to the repeat of the first announcement
+    // starts them again, so the repeat follows a second after the new
+    // one instead of on the old schedule
+    sim_netif_set_ip(192, 168, 1, 51);
+    mdns.Announce();
+    sim_run_until(600000);
+    CHECK_EQ(sent.size(), 2);
+    sim_run_until(1200000);
+    CHECK_EQ(sent.size(), 2);
+    sim_run_until(5 * 1000000LL);
+    CHECK_EQ(sent.size(), 3);
+    for (size_t i = 0; i < sent.size(); i++) {
+        CHECK(is_group(sent[i]));
+        CHECK_EQ(announced_host(sent[i]), i == 0 ? 50 : 51);
+    }
+}
+
+// Announce a full set of services. Returns the size of the announcement
+// and sets *expanded to its size without compression.
+static int announce_full(
+    const char* hostname,
+    const char* instance,
+    const char* txt,
+    int expect_services,
+    int* expanded
+) {
+    sim_reset();
+    sim_netif_set_ip(10, 0, 0, 2);
+    std::vector<Sent> sent;
+    sim_udp_listen(on_send, &sent);
+
+    MdnsResponder mdns(hostname, instance);
+    int added = 0;
+    added += mdns.AddService("_networkclock-a", "_tcp", 80, txt);
+    added += mdns.AddService("_networkclock-b", "_tcp", 81, txt);
+    added += mdns.AddService("_networkclock-c", "_udp", 82, txt);
+    added += mdns.AddService("_networkclock-d", "_udp", 83, txt);
+    added += mdns.AddService("_e", "_tcp", 84);
+    CHECK_EQ(added, expect_services);
+
+    mdns.Start();
+    sim_run_until(5 * 1000000LL);
+    CHECK_EQ(sent.size(), 2);
+    Message m;
+    CHECK(decode(sent[0].data, &m));
+    CHECK_EQ(m.answers.size(), 1 + expect_services * 4);
+    CHECK((int)sent[0].data.size() <= BUFFER_SIZE);
+    *expanded = m.expanded_len;
+    return sent[0].data.size();
+}
+
+static void test_capacity() {
+    // As many services as there is room for, with names like the
+    // defaults
+    int expanded;
+    int len = announce_full(
+        "networkclock", "Network Clock", "path=/api&v=1.0.0", 4, &expanded
+    );
+    printf(
+        "announcement with 4 services: %d bytes, %d uncompressed\n",
+        len,
+        expanded
+    );
+    // Wouldn't fit without compression
+    CHECK(expanded > BUFFER_SIZE);
+
+    // With long names the last service that won't fit is refused when
+    // it is added rather than the announcement being dropped
+    len = announce_full(
+        "networkclock-living-room-shelf",
+        "Network Clock in the Living Room",
+        "path=/api&v=1.0.0",
+        3,
+        &expanded
+    );
+    printf(
+        "announcement with 3 services and long names: %d bytes, "
+        "%d uncompressed\n",
+        len,
+        expanded
+    );
+}
+
+static void test_too_large() {
+    sim_reset();
+    sim_netif_set_ip(10, 0, 0, 2);
+    std::vector<Sent> sent;
+    sim_udp_listen(on_send, &sent);
+
+    // A service whose records can't fit is refused when it is added,
+    // and the ones before it are still announced
+    static char txt[256];
+    memset(txt, 'x', 250);
+    txt[250] = '\0';
+    MdnsResponder mdns("networkclock", "Network Clock");
+    CHECK(mdns.AddService("_http", "_tcp", 80, txt));
+    CHECK(!mdns.AddService("_ntp", "_udp", 123, txt));
+    CHECK(!mdns.AddService("_this-name-is-far-too-long", "_tcp", 80));
+    CHECK(mdns.AddService("_ntp", "_udp", 123));
+
+    mdns.Start();
+    sim_run_until(5 * 1000000LL);
+    CHECK_EQ(sent.size(), 2);
+    Message m;
+    CHECK(decode(sent[0].data, &m));
+    CHECK_EQ(m.answers.size(), 9);
+}
+
+static void test_queries() {
+    sim_reset();
+    sim_netif_set_ip(192, 168, 1, 50);
+    std::vector<Sent> sent;
+    sim_udp_listen(on_send, &sent);
+
+    MdnsResponder mdns("networkclock", "Network Clock");
+    mdns.AddService("_http", "_tcp", 80, "path=/api");
+    mdns.AddService("_ntp", "_udp", 123);
+    mdns.Start();
+    sim_run_until(5 * 1000000LL);
+    sent.clear();
+    Message m;
+
+    // Names are matched without regard to case
+    ask(query("NetworkClock.LOCAL", TYPE_A));
+    CHECK_EQ(sent.size(), 1);
+    CHECK(is_group(sent.back()));
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.answers.size(), 1);
+    CHECK_EQ(m.answers[0].type, TYPE_A);
+    CHECK_EQ(m.answers[0].ttl, 120);
+
+    // Browsing gets the instance and everything needed to connect
+    ask(query("_http._tcp.local", TYPE_PTR));
+    CHECK_EQ(sent.size(), 2);
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.answers.size(), 1);
+    CHECK(m.answers[0].target == "Network Clock._http._tcp.local");
+    CHECK_EQ(m.additional.size(), 3);
+    CHECK_EQ(count_type(m.additional, TYPE_SRV), 1);
+    CHECK_EQ(count_type(m.additional, TYPE_TXT), 1);
+    CHECK_EQ(count_type(m.additional, TYPE_A), 1);
+
+    ask(query("_services._dns-sd._udp.local", TYPE_PTR));
+    CHECK_EQ(sent.size(), 3);
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.answers.size(), 2);
+    CHECK(m.answers[0].target == "_http._tcp.local");
+    CHECK(m.answers[1].target == "_ntp._udp.local");
+
+    ask(query("Network Clock._ntp._udp.local", TYPE_SRV));
+    CHECK_EQ(sent.size(), 4);
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.answers.size(), 1);
+    CHECK_EQ(m.answers[0].port, 123);
+    CHECK_EQ(m.additional.size(), 1);
+    CHECK_EQ(m.additional[0].type, TYPE_A);
+
+    // A second question pointing back in to the first
+    std::vector<uint8_t> q = query_header(0, 2);
+    put_question(&q, "_http._tcp.local", TYPE_PTR, CLASS_IN);
+    put_question(&q, "_ntp._udp@23", TYPE_PTR, CLASS_IN);
+    ask(q);
+    CHECK_EQ(sent.size(), 5);
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.answers.size(), 2);
+
+    // Asking for a unicast reply
+    ask(query("networkclock.local", TYPE_ANY, CLASS_IN | UNICAST_RESPONSE));
+    CHECK_EQ(sent.size(), 6);
+    CHECK(!is_group(sent.back()));
+    CHECK_EQ(sent.back().addr[3], 10);
+    CHECK_EQ(sent.back().port, MDNS_PORT);
+
+    // A plain DNS resolver gets its ID and question back, short TTLs and
+    // no cache flush bit
+    q = query_header(0x1234, 1);
+    put_question(&q, "networkclock.local", TYPE_A, CLASS_IN);
+    ask(q, 40000);
+    CHECK_EQ(sent.size(), 7);
+    CHECK_EQ(sent.back().port, 40000);
+    CHECK(decode(sent.back().data, &m));
+    CHECK_EQ(m.id, 0x1234);
+    CHECK_EQ(m.questions.size(), 1);
+    CHECK(m.questions[0] == "networkclock.local");
+    CHECK_EQ(m.answers.size(), 1);
+    CHECK(m.answers[0].ttl <= 10);
+    CHECK_EQ(m.answers[0].rclass, CLASS_IN);
+
+    // Nothing is sent for other names, responses or broken packets
+    ask(query("otherclock.local", TYPE_A));
+    std::vector<uint8_t> response = query("networkclock.local", TYPE_A);
+    response[2] = 0x84;
+    ask(response);
+    q = query_header(0, 1);
+    put_question(&q, "loop@12", TYPE_A, CLASS_IN);
+    ask(q);
+    q = query("networkclock.local", TYPE_A);
+    q.resize(q.size() - 3);
+    ask(q);
+    CHECK_EQ(sent.size(), 7);
+}
+
+int main() {
+    test_announcement();
+    test_reannounce();
+    test_capacity();
+    test_too_large();
+    test_queries();
+    printf("sizeof(MdnsResponder) on this host: %d bytes\n",
+        (int)sizeof(MdnsResponder));
+    return test_result("mdns");
+}
@@ -0,0 +1,155 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for building NTP responses. Fields are read back from the
+// packet by offset as a client would.
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ntp_packet.hpp"
+#include "test.hpp"
+
+#define NTP_UNIX_OFFSET 2208988800LL
+
+static uint32_t get_u32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+        | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+// A request as sent by a client of the given version and mode
+static void make_request(uint8_t* buf, int version, int mode) {
+    memset(buf, 0, NTP_PACKET_LEN);
+    buf[0] = (version << 3) | mode;
+    buf[2] = 6; // Poll
+    for (int i = 0; i < 8; i++) {
+        buf[40 + i] = 0xA0 + i; // Transmit timestamp
+    }
+}
+
+static NtpServerState synced_state() {
+    NtpServerState state;
+    state.stratum = 3;
+    state.leap = NTP_LEAP_NONE;
+    state.reference_id = 0x0100000A; // 10.0.0.1 in network order
+    state.root_delay_us = 30000;
+    state.root_dispersion_us = 51500;
+    state.reference.tv_sec = 1700000000;
+    state.reference.tv_usec = 0;
+    return state;
+}
+
+static void test_fields() {
+    uint8_t request[NTP_PACKET_LEN];
+    uint8_t response[NTP_PACKET_LEN];
+    make_request(request, 4, 3);
+    NtpServerState state = synced_state();
+    struct timeval received = {1700000100, 500000};
+
+    CHECK(ntp_build_response(request, response, &state, &received));
+    CHECK_EQ(response[0] >> 6, NTP_LEAP_NONE);
+    CHECK_EQ((response[0] >> 3) & 7, 4);
+    CHECK_EQ(response[0] & 7, 4);
+    CHECK_EQ(response[1], 3);
+    CHECK_EQ(response[2], 6);
+    CHECK_EQ((int8_t)response[3], -20);
+
+    // Root delay and dispersion in 16.16 seconds
+    CHECK_EQ(get_u32(response + 4), (30000LL << 16) / 1000000);
+    CHECK_EQ(get_u32(response + 8), (51500LL << 16) / 1000000);
+    CHECK(memcmp(response + 12, "\x0A\x00\x00\x01", 4) == 0);
+
+    CHECK_EQ(get_u32(response + 16), 1700000000LL + NTP_UNIX_OFFSET);
+    CHECK_EQ(get_u32(response + 20), 0);
+    CHECK(memcmp(response + 24, request + 40, 8) == 0);
+    CHECK_EQ(get_u32(response + 32), 1700000100LL + NTP_UNIX_OFFSET);
+    CHECK_EQ(get_u32(response + 36), 0x80000000LL);
+
+    struct timeval transmit = {1700000100, 500250};
+    ntp_set_transmit_time(response, &transmit);
+    CHECK_EQ(get_u32(response + 40), 1700000100LL + NTP_UNIX_OFFSET);
+    CHECK_EQ(get_u32(response + 44), (500250LL << 32) / 1000000);
+}
+
+static void test_in_place() {
+    uint8_t buf[NTP_PACKET_LEN];
+    uint8_t request[NTP_PACKET_LEN];
+    make_request(buf, 3, 3);
+    memcpy(request, buf, sizeof(request));
+    NtpServerState state = synced_state();
+    struct timeval received = {1700000100, 0};
+
+    // The originate time survives the request being overwritten
+    CHECK(ntp_build_response(buf, buf, &state, &received));
+    CHECK(memcmp(buf + 24, request + 40, 8) == 0);
+    CHECK_EQ((buf[0] >> 3) & 7, 3);
+}
+
+static void test_unsynced() {
+    uint8_t request[NTP_PACKET_LEN];
+    uint8_t response[NTP_PACKET_LEN];
+    make_request(request, 4, 3);
+    NtpServerState state = synced_state();
+    state.stratum = NTP_STRATUM_UNSYNC;
+    state.leap = NTP_LEAP_UNSYNC;
+    memcpy(&state.reference_id, "INIT", 4);
+    struct timeval received = {100, 0};
+
+    CHECK(ntp_build_response(request, response, &state, &received));
+    CHECK_EQ(response[0] >> 6, NTP_LEAP_UNSYNC);
+    CHECK_EQ(response[1], NTP_STRATUM_UNSYNC);
+    CHECK(memcmp(response + 12, "INIT", 4) == 0);
+    // No reference time when we have never been set
+    CHECK_EQ(get_u32(response + 16), 0);
+}
+
+static void test_rejected() {
+    uint8_t request[NTP_PACKET_LEN];
+    uint8_t response[NTP_PACKET_LEN];
+    NtpServerState state = synced_state();
+    struct timeval received = {1700000100, 0};
+
+    // Only client requests of a version we know are answered
+    int modes[] = {0, 1, 2, 4, 5, 6, 7};
+    for (int mode : modes) {
+        make_request(request, 4, mode);
+        CHECK(!ntp_build_response(request, response, &state, &received));
+    }
+    make_request(request, 0, 3);
+    CHECK(!ntp_build_response(request, response, &state, &received));
+    make_request(request, 5, 3);
+    CHECK(!ntp_build_response(request, response, &state, &received));
+}
+
+static void test_eras() {
+    uint8_t request[NTP_PACKET_LEN];
+    uint8_t response[NTP_PACKET_LEN];
+    make_request(request, 4, 3);
+    NtpServerState state = synced_state();
+
+    // NTP seconds wrap to 0 on 2036-02-07 06:28:16 UTC
+    struct timeval era = {2085978496LL, 0};
+    CHECK(ntp_build_response(request, response, &state, &era));
+    CHECK_EQ(get_u32(response + 32), 0);
+
+    // time_t is 32 bits on the device and goes negative in 2038. The
+    // timestamp carries on counting up.
+    struct timeval wrapped;
+    wrapped.tv_sec = (time_t)(int32_t)0x80000010;
+    wrapped.tv_usec = 0;
+    CHECK(ntp_build_response(request, response, &state, &wrapped));
+    CHECK_EQ(
+        get_u32(response + 32),
+        (uint32_t)(0x80000010LL + NTP_UNIX_OFFSET)
+    );
+}
+
+int main() {
+    test_fields();
+    test_in_place();
+    test_unsynced();
+    test_rejected();
+    test_eras();
+    return test_result("ntp_packet");
+}
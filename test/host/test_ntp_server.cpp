@@ -0,0 +1,244 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for the SNTP server. Requests are delivered through the
+// emulated lwIP UDP layer to the server's receive callback, and each
+// response is read back by offset as a client would. The clock is set
+// with settimeofday() so Clock records each sync as it does on the
+// device.
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include "clock.hpp"
+#include "ntp_packet.hpp"
+#include "ntp_server.hpp"
+#include "fakes/lwip.hpp"
+#include "fakes/ntp.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/wall_clock.hpp"
+#include "test.hpp"
+
+#define NTP_PORT 123
+#define NTP_UNIX_OFFSET 2208988800LL
+#define SECOND_US 1000000LL
+
+#define UPSTREAM_STRATUM 2
+#define ROOT_DELAY_MS 30
+#define BASE_DISPERSION_MS 50
+#define MAX_AGE 3600
+
+// Wall clock time the clock is synced to
+#define SYNC_SECONDS 1700000000LL
+
+// Rate dispersion grows at, in us per second
+#define PHI_PPM 15
+
+// Transmit timestamp sent in each request, which must come back as the
+// originate timestamp
+static const uint8_t kTransmit[8] = {
+    0xE9, 0x1A, 0x2B, 0x3C, 0x11, 0x22, 0x33, 0x44
+};
+
+static std::vector<std::vector<uint8_t>> responses;
+
+static void on_sent(
+    const uint8_t* data,
+    int len,
+    const ip_addr_t* addr,
+    uint16_t port,
+    void* arg
+) {
+    responses.push_back(std::vector<uint8_t>(data, data + len));
+}
+
+static uint32_t get_u32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+        | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+// An NTP timestamp in microseconds since the Unix epoch
+static int64_t get_timestamp(const uint8_t* buf) {
+    int64_t seconds = (int64_t)get_u32(buf) - NTP_UNIX_OFFSET;
+    uint64_t fraction = get_u32(buf + 4);
+    return seconds * SECOND_US + ((fraction * SECOND_US) >> 32);
+}
+
+// 16.16 seconds, as root delay and dispersion are sent
+static uint32_t short_format(uint64_t us) {
+    return (us << 16) / SECOND_US;
+}
+
+// Send a client request and return the response
+static std::vector<uint8_t> ask() {
+    uint8_t request[NTP_PACKET_LEN];
+    memset(request, 0, sizeof(request));
+    request[0] = (4 << 3) | 3; // Version 4 client
+    memcpy(request + 40, kTransmit, sizeof(kTransmit));
+
+    ip_addr_t from;
+    IP_ADDR4(&from, 192, 168, 1, 50);
+    size_t before = responses.size();
+    sim_udp_deliver(NTP_PORT, request, sizeof(request), &from, 50123);
+    sim_run_until(sim_now_us() + 10000);
+
+    CHECK_EQ(responses.size(), before + 1);
+    if (responses.size() != before + 1) {
+        return std::vector<uint8_t>(NTP_PACKET_LEN, 0);
+    }
+    std::vector<uint8_t> response = responses.back();
+    CHECK_EQ(response.size(), NTP_PACKET_LEN);
+    response.resize(NTP_PACKET_LEN);
+    return response;
+}
+
+// Start a clock and a server. SNTP is left unable to reach its server
+// so only the test sets the clock.
+static Clock* start(int base_dispersion_ms, int max_age) {
+    sim_reset();
+    responses.clear();
+    sim_udp_listen(on_sent, NULL);
+
+    SimNtpNetwork network = {};
+    network.start_us = SYNC_SECONDS * SECOND_US;
+    sim_ntp_network(&network);
+    sim_ntp_outage(true);
+
+    // Never freed, as SNTP is left polling when the simulation is reset
+    Clock* clock = new Clock("pool.ntp.org");
+    NtpServer* server = new NtpServer(
+        clock,
+        UPSTREAM_STRATUM,
+        ROOT_DELAY_MS,
+        base_dispersion_ms,
+        max_age
+    );
+    server->Start();
+    sim_run_until(1000);
+    return clock;
+}
+
+static void sync_clock() {
+    struct timeval tv = {(time_t)SYNC_SECONDS, 0};
+    settimeofday(&tv, NULL);
+}
+
+// Until the clock is set, clients are told not to trust us
+static void check_unsynced(const std::vector<uint8_t>& r) {
+    CHECK_EQ(r[0] >> 6, NTP_LEAP_UNSYNC);
+    CHECK_EQ(r[1], NTP_STRATUM_UNSYNC);
+    CHECK(memcmp(&r[12], "INIT", 4) == 0);
+}
+
+static void test_unsynced() {
+    start(BASE_DISPERSION_MS, MAX_AGE);
+    std::vector<uint8_t> r = ask();
+    check_unsynced(r);
+    CHECK(memcmp(&r[24], kTransmit, sizeof(kTransmit)) == 0);
+}
+
+static void test_synced() {
+    Clock* clock = start(BASE_DISPERSION_MS, MAX_AGE);
+    sync_clock();
+    CHECK(clock->Synced());
+    sim_run_until(sim_now_us() + 10 * SECOND_US);
+
+    std::vector<uint8_t> r = ask();
+    CHECK_EQ(r[0] >> 6, NTP_LEAP_NONE);
+    CHECK_EQ(r[0] & 7, 4);
+    CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+    CHECK(memcmp(&r[12], "\xC0\x00\x02\x7B", 4) == 0);
+    CHECK_EQ(get_u32(&r[4]), short_format(ROOT_DELAY_MS * 1000));
+    CHECK_EQ(
+        get_u32(&r[8]),
+        short_format(BASE_DISPERSION_MS * 1000 + 10 * PHI_PPM)
+    );
+
+    // Set at the sync, and received before being sent
+    CHECK_EQ(get_timestamp(&r[16]), SYNC_SECONDS * SECOND_US);
+    CHECK(memcmp(&r[24], kTransmit, sizeof(kTransmit)) == 0);
+    int64_t received = get_timestamp(&r[32]);
+    int64_t transmit = get_timestamp(&r[40]);
+    CHECK(received >= (SYNC_SECONDS + 10) * SECOND_US);
+    CHECK(received <= transmit);
+    CHECK(transmit <= sim_wall_us());
+}
+
+static void test_dispersion_grows() {
+    start(BASE_DISPERSION_MS, MAX_AGE);
+    sync_clock();
+
+    uint32_t last = 0;
+    for (int age = 1; age <= MAX_AGE; age *= 4) {
+        sim_wall_set_us((SYNC_SECONDS + age) * SECOND_US);
+        std::vector<uint8_t> r = ask();
+        uint32_t dispersion = get_u32(&r[8]);
+        CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+        CHECK_EQ(
+            dispersion,
+            short_format(BASE_DISPERSION_MS * 1000 + age * PHI_PPM)
+        );
+        CHECK(dispersion > last);
+        last = dispersion;
+    }
+}
+
+static void test_max_age() {
+    start(BASE_DISPERSION_MS, MAX_AGE);
+    sync_clock();
+
+    sim_wall_set_us((SYNC_SECONDS + MAX_AGE) * SECOND_US);
+    std::vector<uint8_t> r = ask();
+    CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+    CHECK_EQ(
+        get_u32(&r[8]),
+        short_format(BASE_DISPERSION_MS * 1000 + MAX_AGE * PHI_PPM)
+    );
+
+    // Too long without a sync
+    sim_wall_set_us((SYNC_SECONDS + MAX_AGE + 1) * SECOND_US);
+    check_unsynced(ask());
+
+    // Until the next one
+    sync_clock();
+    r = ask();
+    CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+}
+
+static void test_clock_behind_sync() {
+    start(BASE_DISPERSION_MS, MAX_AGE);
+    sync_clock();
+
+    // Behind the time of the last sync the age is taken as 0, not
+    // wrapped in to a huge dispersion
+    sim_wall_set_us((SYNC_SECONDS - 100) * SECOND_US);
+    std::vector<uint8_t> r = ask();
+    CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+    CHECK_EQ(get_u32(&r[8]), short_format(BASE_DISPERSION_MS * 1000));
+}
+
+static void test_dispersion_saturates() {
+    // Base and growth that overflow 32 bits of us between them
+    int base_ms = 4000000;
+    int max_age = 100000000;
+    start(base_ms, max_age);
+    sync_clock();
+
+    sim_wall_set_us((SYNC_SECONDS + 50000000) * SECOND_US);
+    std::vector<uint8_t> r = ask();
+    CHECK_EQ(r[1], UPSTREAM_STRATUM + 1);
+    CHECK_EQ(get_u32(&r[8]), short_format(UINT32_MAX));
+}
+
+int main() {
+    test_unsynced();
+    test_synced();
+    test_dispersion_grows();
+    test_max_age();
+    test_clock_behind_sync();
+    test_dispersion_saturates();
+    return test_result("ntp_server");
+}
@@ -0,0 +1,237 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Deterministic tests for the timer wheel, driven by a virtual tick.
+
+#include <cstdlib>
+#include <vector>
+
+#include "test.hpp"
+#include "timer_wheel.hpp"
+
+// Records each time a timer runs
+struct Record {
+    TimerWheel* wheel;
+    int runs = 0;
+    uint32_t last_run = 0;
+};
+
+static void record_run(void* arg) {
+    Record* r = (Record*)arg;
+    r->runs++;
+    r->last_run = r->wheel->Now();
+}
+
+static void test_one_shot() {
+    TimerWheel wheel(1000);
+    Record r;
+    r.wheel = &wheel;
+    Timer t(record_run, &r);
+
+    wheel.Schedule(&t, 10);
+    CHECK_EQ(wheel.TicksUntilNext(), 10);
+    CHECK_EQ(wheel.Advance(1009), 0);
+    CHECK_EQ(wheel.Advance(1010), 1);
+    CHECK_EQ(r.last_run, 1010);
+    CHECK(!t.Active());
+    CHECK_EQ(wheel.Advance(2000), 0);
+
+    // A delay of 0 runs on the next tick
+    wheel.Schedule(&t, 0);
+    CHECK_EQ(wheel.Advance(2001), 1);
+    CHECK_EQ(r.last_run, 2001);
+}
+
+static void test_periodic() {
+    TimerWheel wheel(0);
+    Record r;
+    r.wheel = &wheel;
+    Timer t(record_run, &r);
+
+    wheel.Schedule(&t, 5, 100);
+    for (uint32_t now = 1; now <= 10000; now++) {
+        int before = r.runs;
+        wheel.Advance(now);
+        if (r.runs != before) {
+            CHECK_EQ(r.last_run % 100, 5);
+        }
+    }
+    CHECK_EQ(r.runs, 100);
+}
+
+static void test_long_delays() {
+    // One delay within each level, plus one beyond the top level
+    const uint32_t delays[] = {63, 64, 4095, 4096, 262143, 262144,
+        16777215, 16777216, 40000000};
+
+    for (uint32_t start : {0u, 12345u, 0xFFFFFF00u}) {
+        for (uint32_t delay : delays) {
+            TimerWheel wheel(start);
+            Record r;
+            r.wheel = &wheel;
+            Timer t(record_run, &r);
+
+            wheel.Schedule(&t, delay);
+            wheel.Advance(start + delay - 1);
+            CHECK_EQ(r.runs, 0);
+            wheel.Advance(start + delay);
+            CHECK_EQ(r.runs, 1);
+            CHECK_EQ(r.last_run, start + delay);
+        }
+    }
+}
+
+// Cancels another timer when run
+struct Canceller {
+    TimerWheel* wheel;
+    Timer* victim;
+};
+
+static void cancel_victim(void* arg) {
+    Canceller* c = (Canceller*)arg;
+    c->wheel->Cancel(c->victim);
+}
+
+static void test_cancel_from_callback() {
+    TimerWheel wheel(0);
+    Record r;
+    r.wheel = &wheel;
+    Timer victim(record_run, &r);
+    Canceller c = {&wheel, &victim};
+    Timer canceller(cancel_victim, &c);
+
+    // Both due on the same tick. Whichever order they are in, the
+    // victim must not run after being cancelled.
+    wheel.Schedule(&victim, 10);
+    wheel.Schedule(&canceller, 10);
+    wheel.Advance(10);
+    CHECK(r.runs <= 1);
+    CHECK(!victim.Active());
+    CHECK_EQ(wheel.TicksUntilNext(), UINT32_MAX);
+}
+
+static void test_late_advance() {
+    // Advancing a long way at once runs a periodic timer once rather
+    // than once for every period that was missed
+    TimerWheel wheel(0);
+    Record r;
+    r.wheel = &wheel;
+    Timer t(record_run, &r);
+
+    wheel.Schedule(&t, 1, 100);
+    CHECK_EQ(wheel.Advance(800), 1);
+    CHECK_EQ(r.last_run, 1);
+
+    // It stays in phase with when it was first due
+    CHECK_EQ(wheel.Advance(800 + wheel.TicksUntilNext() - 1), 0);
+    CHECK_EQ(wheel.Advance(801), 1);
+    CHECK_EQ(r.last_run, 801);
+    CHECK_EQ(wheel.Advance(901), 1);
+}
+
+static void test_rebase() {
+    TimerWheel wheel(0);
+    Record r;
+    r.wheel = &wheel;
+    Timer t(record_run, &r);
+    Timer far(record_run, &r);
+
+    wheel.Schedule(&t, 50, 1000);
+    wheel.Schedule(&far, 100000);
+    wheel.Rebase(5000000);
+    CHECK_EQ(wheel.Now(), 5000000);
+
+    CHECK_EQ(wheel.Advance(5000049), 0);
+    CHECK_EQ(wheel.Advance(5000050), 1);
+    CHECK_EQ(wheel.Advance(5001050), 1);
+    CHECK_EQ(wheel.Advance(5099999), 1);
+    CHECK_EQ(wheel.Advance(5100000), 1);
+    CHECK_EQ(r.last_run, 5100000);
+}
+
+// Timer for the randomised test. Tracks when it is next expected
+struct Expect {
+    TimerWheel* wheel;
+    uint32_t* target;
+    uint32_t* last_run;
+    uint32_t due;
+    uint32_t period;
+    int runs = 0;
+    bool bad = false;
+};
+
+static void check_expected(void* arg) {
+    Expect* e = (Expect*)arg;
+    uint32_t now = e->wheel->Now();
+
+    // Runs exactly when due and in deadline order
+    if (now != e->due || (int32_t)(now - *e->last_run) < 0) {
+        e->bad = true;
+    }
+    *e->last_run = now;
+    e->runs++;
+
+    if (e->period != 0) {
+        do {
+            e->due += e->period;
+        } while ((int32_t)(e->due - *e->target) <= 0);
+    }
+}
+
+static void test_random() {
+    srand(1);
+    for (uint32_t start : {0u, 12345u, 0xFFFFF000u}) {
+        TimerWheel wheel(start);
+        uint32_t target = start;
+        uint32_t last_run = start;
+        std::vector<Expect> expects(500);
+        std::vector<Timer*> timers;
+
+        for (Expect& e : expects) {
+            uint32_t delay = rand() % ((rand() % 2) ? 100 : 3000000);
+            e.wheel = &wheel;
+            e.target = &target;
+            e.last_run = &last_run;
+            e.period = (rand() % 3 == 0) ? 1 + rand() % 5000 : 0;
+            e.due = start + ((delay != 0) ? delay : 1);
+            Timer* t = new Timer(check_expected, &e);
+            timers.push_back(t);
+            wheel.Schedule(t, delay, e.period);
+        }
+
+        while ((uint32_t)(target - start) < 3100000) {
+            uint32_t next = wheel.TicksUntilNext();
+            if (next == UINT32_MAX) {
+                break;
+            }
+            // Sometimes step exactly, sometimes fall well behind
+            target += (rand() % 4 == 0) ? next + rand() % 20000 : next;
+            last_run = wheel.Now();
+            wheel.Advance(target);
+        }
+
+        int bad = 0;
+        int missed = 0;
+        for (Expect& e : expects) {
+            bad += e.bad;
+            missed += (e.runs == 0);
+        }
+        CHECK_EQ(bad, 0);
+        CHECK_EQ(missed, 0);
+
+        for (Timer* t : timers) {
+            delete t;
+        }
+    }
+}
+
+int main() {
+    test_one_shot();
+    test_periodic();
+    test_long_delays();
+    test_cancel_from_callback();
+    test_late_advance();
+    test_rebase();
+    test_random();
+    return test_result("timer_wheel");
+}
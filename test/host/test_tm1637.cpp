@@ -0,0 +1,259 @@
+// SPDX-FileCopyrightText: 2023 Matthew Nickson <mnickson@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Tests for the TM1637 driver. Its pins are decoded by an emulated
+// TM1637 to check which bytes each write puts on the wire, that the
+// display recovers from failed and garbled writes, and how long the
+// display keeps the bus busy for.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "display_bus.hpp"
+#include "tm1637.hpp"
+#include "fakes/sim.hpp"
+#include "fakes/tm1637_decoder.hpp"
+#include "test.hpp"
+
+// Segments for each digit and the colon, as the driver sends them
+static const uint8_t seg[10] = {
+    0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F
+};
+#define COLON 0x80
+#define DATA_AUTO 0x40
+#define DATA_FIXED 0x44
+#define ADDRESS(pos) (0xC0 | (pos))
+#define CONTROL 0x8F
+
+struct Commits {
+    int count = 0;
+    char frame[TM1637::kMaxDigits];
+    int len = 0;
+};
+
+static void on_commit(const char* frame, int len, void* arg) {
+    Commits* c = (Commits*)arg;
+    c->count++;
+    c->len = len;
+    memcpy(c->frame, frame, len);
+}
+
+static void colon_off(void* arg) {
+    ((TM1637*)arg)->SetColon(false);
+}
+
+static void test_incremental() {
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 4, &bus);
+    Tm1637Decoder decoder(0, 2);
+
+    // The first write sends every digit
+    char a[4] = {1, 2, 3, 4};
+    disp.Write(a);
+    std::vector<uint8_t> expect = {
+        DATA_AUTO, ADDRESS(0),
+        seg[1], (uint8_t)(seg[2] | COLON), seg[3], seg[4],
+        CONTROL
+    };
+    CHECK(decoder.Bytes() == expect);
+    CHECK_EQ(decoder.Digit(3), 4);
+    CHECK(decoder.Colon());
+
+    // Then only the digits that changed
+    decoder.ClearBytes();
+    char b[4] = {1, 2, 3, 5};
+    disp.Write(b);
+    expect = {DATA_AUTO, ADDRESS(3), seg[5], CONTROL};
+    CHECK(decoder.Bytes() == expect);
+    CHECK_EQ(decoder.Digit(3), 5);
+
+    // Or none at all
+    decoder.ClearBytes();
+    disp.Write(b);
+    expect = {DATA_AUTO, CONTROL};
+    CHECK(decoder.Bytes() == expect);
+    CHECK_EQ(decoder.Errors(), 0);
+}
+
+static void test_colon_commit() {
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+    Commits commits;
+    disp.SetOnCommit(on_commit, &commits);
+
+    char a[6] = {1, 2, 3, 4, 5, 6};
+    disp.Write(a);
+    CHECK_EQ(commits.count, 1);
+    CHECK_EQ(commits.len, 6);
+
+    // A staged frame isn't sent until the colon changes, then goes out
+    // in the same transfer as it
+    char b[6] = {1, 2, 3, 4, 5, 7};
+    disp.Stage(b);
+    CHECK_EQ(commits.count, 1);
+    decoder.ClearBytes();
+    disp.SetColon(false);
+    // The colon's digit and the last digit changed, so each goes out
+    // from its own address without the digits between
+    std::vector<uint8_t> expect = {
+        DATA_AUTO,
+        ADDRESS(1), seg[2],
+        ADDRESS(5), seg[7],
+        CONTROL
+    };
+    CHECK(decoder.Bytes() == expect);
+    CHECK(!decoder.Colon());
+    CHECK_EQ(decoder.Digit(5), 7);
+    CHECK_EQ(commits.count, 2);
+    CHECK_EQ(commits.frame[5], 7);
+
+    // Without a staged frame only the colon digit is written
+    decoder.ClearBytes();
+    disp.SetColon(true);
+    expect = {DATA_FIXED, ADDRESS(1), (uint8_t)(seg[2] | COLON)};
+    CHECK(decoder.Bytes() == expect);
+    CHECK(decoder.Colon());
+    CHECK_EQ(commits.count, 2);
+    CHECK_EQ(decoder.Errors(), 0);
+}
+
+static void test_heal_after_timeout() {
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 4, &bus);
+    Tm1637Decoder decoder(0, 2);
+    Commits commits;
+    disp.SetOnCommit(on_commit, &commits);
+
+    char a[4] = {1, 2, 3, 4};
+    disp.Write(a);
+    CHECK_EQ(commits.count, 1);
+
+    // Stall the bus so the next write times out
+    sim_hw_timer_stall(sim_now_us() + 1000000);
+    char b[4] = {1, 2, 3, 5};
+    disp.Write(b);
+    CHECK_EQ(commits.count, 1);
+    sim_run_until(sim_now_us() + 1000000);
+
+    // We don't know what the display shows so every digit is sent
+    decoder.ClearBytes();
+    disp.Write(b);
+    std::vector<uint8_t> expect = {
+        DATA_AUTO, ADDRESS(0),
+        seg[1], (uint8_t)(seg[2] | COLON), seg[3], seg[5],
+        CONTROL
+    };
+    CHECK(decoder.Bytes() == expect);
+    CHECK_EQ(commits.count, 2);
+
+    // And the next write goes back to sending only what changed
+    decoder.ClearBytes();
+    disp.Write(a);
+    expect = {DATA_AUTO, ADDRESS(3), seg[4], CONTROL};
+    CHECK(decoder.Bytes() == expect);
+}
+
+static void test_periodic_refresh() {
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 4, &bus);
+    Tm1637Decoder decoder(0, 2);
+
+    char a[4] = {1, 2, 3, 4};
+    disp.Write(a);
+
+    // Garble a digit the driver believes is already shown. Writing the
+    // same frame leaves it until the next full refresh.
+    decoder.SetSegments(0, 0);
+    for (int second = 1; second < 60; second++) {
+        sim_run_until(second * 1000000LL);
+        disp.Write(a);
+    }
+    CHECK_EQ(decoder.Segments(0), 0);
+
+    sim_run_until(60 * 1000000LL);
+    disp.Write(a);
+    CHECK_EQ(decoder.Digit(0), 1);
+    CHECK_EQ(decoder.Errors(), 0);
+}
+
+static void test_overlap_counted_once() {
+    sim_reset();
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+
+    // A colon change queued part way through a full frame waits for
+    // the frame. The bus is only busy from the start of the frame to the
+    // end of the colon.
+    sim_run_until(1000000);
+    sim_schedule(1000100, colon_off, &disp);
+    char a[6] = {1, 2, 3, 4, 5, 6};
+    disp.Write(a);
+    int64_t busy = decoder.LastStopUs() - 1000000;
+    CHECK_EQ(decoder.Starts(), 5);
+
+    // Roll over to the next second to close the totals
+    sim_run_until(2000000);
+    disp.SetColon(true);
+    printf(
+        "frame then colon: %lld us on the wire, %lld us counted\n",
+        (long long)busy,
+        (long long)disp.BusMaxUs()
+    );
+    CHECK(disp.BusMaxUs() >= busy);
+    CHECK(disp.BusMaxUs() <= busy + 1000);
+}
+
+// Run the display as it is run with seconds shown, where each second
+// a new frame is staged and committed with the colon coming on and the
+// colon goes off at the half second. Interrupts are held off by up to
+// 40us as they would be under WiFi load.
+static void test_bus_budget() {
+    sim_reset();
+    sim_hw_timer_jitter(40, 1);
+    DisplayBus bus;
+    TM1637 disp(0, 2, 6, &bus);
+    Tm1637Decoder decoder(0, 2);
+
+    const int seconds = 3600;
+    for (int s = 0; s < seconds; s++) {
+        char frame[6] = {
+            (char)(s / 36000 % 10), (char)(s / 3600 % 10),
+            (char)(s / 600 % 6), (char)(s / 60 % 10),
+            (char)(s / 10 % 6), (char)(s % 10)
+        };
+        sim_run_until(s * 1000000LL);
+        disp.Stage(frame);
+        disp.SetColon(true);
+        sim_run_until(s * 1000000LL + 500000);
+        disp.SetColon(false);
+    }
+    printf(
+        "seconds shown for %d s: bus busy %lld us/s mean, %lld us/s max\n",
+        seconds,
+        (long long)disp.BusMeanUs(),
+        (long long)disp.BusMaxUs()
+    );
+    CHECK_EQ(decoder.Errors(), 0);
+    CHECK(disp.BusMeanUs() > 0);
+    CHECK(disp.BusMeanUs() <= disp.BusMaxUs());
+    // Under 2.5% of the bus, leaving room for other displays
+    CHECK(disp.BusMaxUs() < 25000);
+}
+
+int main() {
+    test_incremental();
+    test_colon_commit();
+    test_heal_after_timeout();
+    test_periodic_refresh();
+    test_overlap_counted_once();
+    test_bus_budget();
+    return test_result("tm1637");
+}